@@ -0,0 +1,78 @@
+#pragma once
+#include <limits>
+#include "Ray.h"
+#include "Vector3.h"
+
+// Axis aligned bounding box. The corners are kept in an array so the slab
+// test can pick the near / far plane with Ray::sign instead of branching
+struct AABB {
+ public:
+  AABB()
+      : bounds{Vector3r(std::numeric_limits<Real>::max()),
+               Vector3r(-std::numeric_limits<Real>::max())} {}
+  AABB(const Vector3r &min_, const Vector3r &max_) : bounds{min_, max_} {}
+
+  inline void Expand(const Vector3r &point) {
+    for (uint8_t i = 0; i < 3; i++) {
+      bounds[0][i] = std::min(bounds[0][i], point[i]);
+      bounds[1][i] = std::max(bounds[1][i], point[i]);
+    }
+  }
+
+  inline void Expand(const AABB &box) {
+    for (uint8_t i = 0; i < 3; i++) {
+      bounds[0][i] = std::min(bounds[0][i], box.bounds[0][i]);
+      bounds[1][i] = std::max(bounds[1][i], box.bounds[1][i]);
+    }
+  }
+
+  // Shrinks the box to its overlap with another one
+  inline void Clip(const AABB &box) {
+    for (uint8_t i = 0; i < 3; i++) {
+      bounds[0][i] = std::max(bounds[0][i], box.bounds[0][i]);
+      bounds[1][i] = std::min(bounds[1][i], box.bounds[1][i]);
+    }
+  }
+
+  inline bool IsEmpty() const {
+    return bounds[0].x > bounds[1].x || bounds[0].y > bounds[1].y ||
+           bounds[0].z > bounds[1].z;
+  }
+
+  inline Vector3r GetMin() const { return bounds[0]; }
+  inline Vector3r GetMax() const { return bounds[1]; }
+  inline Vector3r Centroid() const { return (bounds[0] + bounds[1]) * 0.5; }
+
+  inline Real SurfaceArea() const {
+    if (IsEmpty()) return 0;
+    Vector3r d = bounds[1] - bounds[0];
+    return 2 * (d.x * d.y + d.y * d.z + d.z * d.x);
+  }
+
+  // Axis with the largest extent (0 = x, 1 = y, 2 = z)
+  inline int MaxExtent() const {
+    Vector3r d = bounds[1] - bounds[0];
+    if (d.x > d.y && d.x > d.z) return 0;
+    return (d.y > d.z) ? 1 : 2;
+  }
+
+  // Slab test, origin is passed separately so traversal loops can hoist it.
+  // On a hit tNear holds the entry distance (clamped to ray.tMin)
+  inline bool Intersect(const Vector3r &origin, const Ray &ray,
+                        const Real tMax, Real &tNear) const {
+    Real tmin = (bounds[ray.sign[0]].x - origin.x) * ray.invDir.x;
+    Real tmax = (bounds[1 - ray.sign[0]].x - origin.x) * ray.invDir.x;
+    Real tymin = (bounds[ray.sign[1]].y - origin.y) * ray.invDir.y;
+    Real tymax = (bounds[1 - ray.sign[1]].y - origin.y) * ray.invDir.y;
+    Real tzmin = (bounds[ray.sign[2]].z - origin.z) * ray.invDir.z;
+    Real tzmax = (bounds[1 - ray.sign[2]].z - origin.z) * ray.invDir.z;
+
+    tmin = std::max(std::max(tmin, tymin), std::max(tzmin, ray.tMin));
+    tmax = std::min(std::min(tmax, tymax), std::min(tzmax, tMax));
+
+    tNear = tmin;
+    return tmin <= tmax;
+  }
+
+  Vector3r bounds[2];
+};
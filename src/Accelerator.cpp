@@ -0,0 +1,51 @@
+#include "Accelerator.h"
+#include "BVH.h"
+#include "Grid.h"
+#include "KdTree.h"
+#include "WideBVH.h"
+
+std::unique_ptr<Accelerator> Accelerator::Create(const Settings &settings) {
+  switch (settings.type) {
+    case BVH4:
+      return std::make_unique<WideBVH<4>>(settings);
+    case BVH8:
+      return std::make_unique<WideBVH<8>>(settings);
+    case GRID:
+      return std::make_unique<Grid>(settings);
+    case KDTREE:
+      return std::make_unique<KdTree>(settings);
+    case BVH2:
+    default:
+      return std::make_unique<BVH>(settings);
+  }
+}
+
+const char *Accelerator::GetBuilderName(const BUILDERS builder) {
+  switch (builder) {
+    case SAH:
+      return "SAH";
+    case LBVH:
+      return "LBVH";
+    case SBVH:
+      return "SBVH";
+  }
+  return "";
+}
+
+std::vector<unsigned> Accelerator::RenumberPrimitives(
+    std::vector<unsigned> &indices, const unsigned primCount) {
+  std::vector<unsigned> order, newIndex(primCount, ~0u);
+  order.reserve(primCount);
+  for (auto &index : indices) {
+    if (newIndex[index] == ~0u) {
+      newIndex[index] = order.size();
+      order.emplace_back(index);
+    }
+    index = newIndex[index];
+  }
+
+  // Primitives no leaf references keep their order at the end
+  for (unsigned i = 0; i < primCount; i++)
+    if (newIndex[i] == ~0u) order.emplace_back(i);
+  return order;
+}
@@ -0,0 +1,189 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "AABB.h"
+#include "Ray.h"
+
+// Implemented by whoever owns the primitives an accelerator was built over
+class PrimitiveIntersector {
+ public:
+  virtual ~PrimitiveIntersector() {}
+
+  // Distance to the intersection with primitive "index", <= 0 if missed
+  virtual Real IntersectPrimitive(unsigned index, const Ray &ray) const = 0;
+
+  // Whether primitive "index" blocks the ray before ray.tMax. Primitives
+  // with an any-hit test of their own (meshes in a scene) override it
+  virtual bool OccludePrimitive(unsigned index, const Ray &ray) const {
+    Real t = IntersectPrimitive(index, ray);
+    return t > BIAS && t < ray.tMax;
+  }
+
+  // Closest hit among the primitives indices[0..count) of a leaf between
+  // BIAS and closest. Returns its distance (-1 if none is closer) and the
+  // primitive in primIndex. Owners with a batched kernel override these two
+  virtual Real IntersectPrimitives(const unsigned *indices,
+                                   const unsigned count, const Ray &ray,
+                                   Real closest, unsigned &primIndex) const {
+    Real hit = -1;
+    for (unsigned i = 0; i < count; i++) {
+      Real t = IntersectPrimitive(indices[i], ray);
+      if (t > BIAS && t < closest) {
+        closest = hit = t;
+        primIndex = indices[i];
+      }
+    }
+    return hit;
+  }
+  // Whether any of them blocks the ray before ray.tMax
+  virtual bool OccludePrimitives(const unsigned *indices, const unsigned count,
+                                 const Ray &ray) const {
+    for (unsigned i = 0; i < count; i++)
+      if (OccludePrimitive(indices[i], ray)) return true;
+    return false;
+  }
+
+  // Bounds of the parts of primitive "index" on either side of an axis
+  // aligned plane, used by spatial split builds. The caller clips them to the
+  // primitive bounds, so by default everything is returned and splits fall
+  // back to cutting the bounding box
+  virtual void SplitPrimitive(unsigned, int, Real, AABB &left,
+                              AABB &right) const {
+    left = right = AABB(Vector3r(-std::numeric_limits<Real>::max()),
+                        Vector3r(std::numeric_limits<Real>::max()));
+  }
+};
+
+// Optional traversal counters, only filled in when a pointer is passed
+struct TraversalStats {
+  uint64_t nodeVisits = 0;
+  uint64_t primitiveTests = 0;
+};
+
+// Raw bytes of one array, used to write accelerators to cache files
+struct DataBlock {
+  const void *data;
+  size_t size;
+};
+
+// Read only view of an array. Traversal goes through views so an
+// accelerator can run either on its own vectors or on a memory mapped cache
+template <typename T>
+struct ArrayView {
+  const T *data = nullptr;
+  size_t size = 0;
+
+  ArrayView() {}
+  ArrayView(const std::vector<T> &array)
+      : data{array.data()}, size{array.size()} {}
+
+  const T &operator[](const size_t i) const { return data[i]; }
+  bool empty() const { return size == 0; }
+  const T *begin() const { return data; }
+  const T *end() const { return data + size; }
+
+  DataBlock ToBlock() const { return {data, size * sizeof(T)}; }
+  // False if the block can't hold an array of T
+  bool FromBlock(const DataBlock &block) {
+    if (block.size % sizeof(T) || uintptr_t(block.data) % alignof(T))
+      return false;
+    data = static_cast<const T *>(block.data);
+    size = block.size / sizeof(T);
+    return true;
+  }
+};
+
+// Checks on arrays read from cache files, so a corrupt or foreign file is
+// rejected instead of sending traversal outside the arrays
+inline bool IndicesBelow(const ArrayView<unsigned> &indices,
+                         const size_t count) {
+  for (unsigned index : indices)
+    if (index >= count) return false;
+  return true;
+}
+inline bool RangeWithin(const unsigned offset, const unsigned count,
+                        const size_t size) {
+  return uint64_t(offset) + count <= size;
+}
+
+// Spatial index over a set of primitive bounds, shared by the mesh level
+// (faces) and the scene level (objects)
+class Accelerator {
+ public:
+  // BVH2: binary BVH, BVH4 / BVH8: binary BVH collapsed to 4 / 8 wide nodes
+  // whose child boxes are tested with SSE / AVX. GRID: uniform grid, for
+  // many small evenly spread primitives. KDTREE: SAH kd-tree with ropes,
+  // tightest culling for primary rays. Grids and kd-trees ignore the builder
+  enum TYPES { BVH2 = 0, BVH4 = 1, BVH8 = 2, GRID = 3, KDTREE = 4 };
+  // SAH: binned surface area heuristic, slower to build but fast to trace.
+  // LBVH: parallel Morton code sort, for very large meshes.
+  // SBVH: SAH with spatial splits, for long thin triangles whose boxes
+  // overlap a lot. References may be duplicated, up to maxDuplication
+  enum BUILDERS { SAH = 0, LBVH = 1, SBVH = 2 };
+
+  struct Settings {
+    TYPES type = BVH2;
+    BUILDERS builder = SAH;
+    double maxDuplication = 0.3;  // SBVH: extra references / primitives
+    unsigned gridLevels = 1;      // GRID: 2 adds subgrids in crowded cells
+    // Refits are followed by a rebuild once they grew the SAH cost past
+    // this factor of the freshly built one
+    double maxRefitGrowth = 1.5;
+  };
+
+  static std::unique_ptr<Accelerator> Create(const Settings &settings);
+  static const char *GetBuilderName(const BUILDERS builder);
+
+  virtual ~Accelerator() {}
+
+  virtual void Build(const std::vector<AABB> &primBounds,
+                     const PrimitiveIntersector &primitives) = 0;
+
+  // Closest hit, returns the distance (-1 on a miss) and the primitive index
+  virtual Real Intersect(const Ray &ray,
+                         const PrimitiveIntersector &primitives,
+                         unsigned &primIndex,
+                         TraversalStats *stats = nullptr) const = 0;
+
+  // Any hit between BIAS and ray.tMax, stops at the first one found. For
+  // shadow rays, which don't care which blocker is the closest
+  virtual bool Occluded(const Ray &ray, const PrimitiveIntersector &primitives,
+                        TraversalStats *stats = nullptr) const = 0;
+
+  virtual AABB GetBounds() const = 0;
+  virtual const char *GetName() const = 0;
+  virtual size_t GetMemoryUsage() const = 0;
+  // Expected cost of a random ray relative to testing one primitive, 0 if
+  // the structure has no such estimate
+  virtual double GetSAHCost() const { return 0; }
+
+  // Updates the bounds bottom-up for primitives that moved, keeping the
+  // topology. Much cheaper than a build but the tree degrades as things move
+  // around, see GetSAHCost. False if the structure can't be refitted
+  virtual bool Refit(const std::vector<AABB> &) { return false; }
+
+  // Arrays the structure is made of, for cache files. Empty if it can't be
+  // cached
+  virtual std::vector<DataBlock> GetArrays() const { return {}; }
+  // Runs on arrays returned by GetArrays (e.g. mapped from a cache file)
+  // without copying them, so they must outlive the accelerator. False if
+  // they don't match this accelerator or don't make a valid structure over
+  // primCount primitives
+  virtual bool SetArrays(const std::vector<DataBlock> &,
+                         const unsigned /*primCount*/) {
+    return false;
+  }
+
+  // Renumbers the primitives in the order the leaves reference them so
+  // their owner can store them that way too. Returns the old index of every
+  // new one, or nothing if the numbering was left alone
+  virtual std::vector<unsigned> ReorderPrimitives(const unsigned) {
+    return {};
+  }
+
+ protected:
+  // ReorderPrimitives for accelerators keeping a single index array
+  static std::vector<unsigned> RenumberPrimitives(
+      std::vector<unsigned> &indices, const unsigned primCount);
+};
@@ -0,0 +1,322 @@
+#include "BVH.h"
+#include <algorithm>
+#include "Refit.h"
+
+BVH::BVH(const Settings &settings_)
+    : settings{settings_},
+      name{std::string("BVH2 (") + GetBuilderName(settings.builder) + ")"} {}
+
+void BVH::Build(const std::vector<AABB> &primBounds,
+                const PrimitiveIntersector &primitives) {
+  nodes.clear();
+  primIndices.clear();
+  depth = 0;
+
+  if (primBounds.empty()) {
+    nodeView = nodes;
+    primView = primIndices;
+    return;
+  }
+
+  if (settings.builder == LBVH)
+    BuildLBVH(primBounds);
+  else if (settings.builder == SBVH)
+    BuildSBVH(primBounds, primitives);
+  else
+    BuildSAH(primBounds);
+
+  nodeView = nodes;
+  primView = primIndices;
+}
+
+void BVH::BuildSAH(const std::vector<AABB> &primBounds) {
+  std::vector<BuildPrimitive> prims(primBounds.size());
+  for (unsigned i = 0; i < primBounds.size(); i++) {
+    prims[i].bounds = primBounds[i];
+    prims[i].centroid = primBounds[i].Centroid();
+    prims[i].index = i;
+  }
+
+  // A binary tree with leaves of at least one primitive never has more than
+  // 2n - 1 nodes
+  nodes.reserve(2 * prims.size() - 1);
+  BuildRecursive(prims, 0, prims.size(), 1);
+
+  primIndices.resize(prims.size());
+  for (unsigned i = 0; i < prims.size(); i++) primIndices[i] = prims[i].index;
+}
+
+unsigned BVH::BuildRecursive(std::vector<BuildPrimitive> &prims,
+                             const unsigned start, const unsigned end,
+                             const unsigned nodeDepth) {
+  depth = std::max(depth, nodeDepth);
+  unsigned nodeIndex = nodes.size();
+  nodes.emplace_back();
+
+  AABB bounds, centroidBounds;
+  for (unsigned i = start; i < end; i++) {
+    bounds.Expand(prims[i].bounds);
+    centroidBounds.Expand(prims[i].centroid);
+  }
+  nodes[nodeIndex].bounds = bounds;
+
+  const unsigned count = end - start;
+  const int axis = centroidBounds.MaxExtent();
+  const double axisMin = centroidBounds.bounds[0][axis];
+  const double axisExtent = centroidBounds.bounds[1][axis] - axisMin;
+
+  // Leaf: few primitives left or all centroids on top of each other
+  auto makeLeaf = [&]() {
+    nodes[nodeIndex].offset = start;
+    nodes[nodeIndex].count = count;
+    nodes[nodeIndex].axis = 0;
+    return nodeIndex;
+  };
+  if (count <= 2 || axisExtent <= 0 || nodeDepth >= BVH_MAX_DEPTH)
+    return makeLeaf();
+
+  // Bin the centroids along the widest axis and sweep the bin boundaries
+  // for the split with the lowest SAH cost
+  struct Bin {
+    AABB bounds;
+    unsigned count = 0;
+  } bins[BVH_SAH_BINS];
+
+  const double binScale = BVH_SAH_BINS / axisExtent;
+  auto binOf = [&](const BuildPrimitive &prim) {
+    unsigned b = unsigned((prim.centroid[axis] - axisMin) * binScale);
+    return std::min(b, BVH_SAH_BINS - 1);
+  };
+  for (unsigned i = start; i < end; i++) {
+    Bin &bin = bins[binOf(prims[i])];
+    bin.count++;
+    bin.bounds.Expand(prims[i].bounds);
+  }
+
+  double rightArea[BVH_SAH_BINS];
+  unsigned rightCount[BVH_SAH_BINS];
+  AABB rightBounds;
+  unsigned rightSum = 0;
+  for (unsigned b = BVH_SAH_BINS - 1; b > 0; b--) {
+    rightBounds.Expand(bins[b].bounds);
+    rightSum += bins[b].count;
+    rightArea[b] = rightBounds.SurfaceArea();
+    rightCount[b] = rightSum;
+  }
+
+  double bestCost = std::numeric_limits<double>::max();
+  unsigned bestSplit = 0;
+  AABB leftBounds;
+  unsigned leftSum = 0;
+  for (unsigned b = 1; b < BVH_SAH_BINS; b++) {
+    leftBounds.Expand(bins[b - 1].bounds);
+    leftSum += bins[b - 1].count;
+    double cost = leftBounds.SurfaceArea() * leftSum +
+                  rightArea[b] * rightCount[b];
+    if (leftSum && rightCount[b] && cost < bestCost) {
+      bestCost = cost;
+      bestSplit = b;
+    }
+  }
+
+  const double parentArea = bounds.SurfaceArea();
+  const double splitCost =
+      BVH_TRAVERSAL_COST +
+      (parentArea > 0 ? bestCost / parentArea
+                      : std::numeric_limits<double>::max());
+  if (bestSplit == 0 || (count <= BVH_MAX_LEAF_SIZE && splitCost >= count))
+    return makeLeaf();
+
+  BuildPrimitive *mid = std::partition(
+      &prims[start], &prims[start] + count,
+      [&](const BuildPrimitive &prim) { return binOf(prim) < bestSplit; });
+  const unsigned split = mid - &prims[0];
+
+  nodes[nodeIndex].count = 0;
+  nodes[nodeIndex].axis = axis;
+  BuildRecursive(prims, start, split, nodeDepth + 1);
+  // nodes may have been reallocated by the recursion, index again
+  unsigned right = BuildRecursive(prims, split, end, nodeDepth + 1);
+  nodes[nodeIndex].offset = right;
+  return nodeIndex;
+}
+
+Real BVH::Intersect(const Ray &ray, const PrimitiveIntersector &primitives,
+                    unsigned &primIndex, TraversalStats *stats) const {
+  if (nodeView.empty()) return -1;
+
+  const Vector3r origin = ray.GetOrigin();
+  Real closest = ray.tMax;
+  bool hit = false;
+
+  unsigned stack[BVH_MAX_DEPTH];
+  unsigned stackSize = 0;
+  unsigned current = 0;
+  Real tNear;
+
+  while (true) {
+    const BVHNode &node = nodeView[current];
+    if (stats) stats->nodeVisits++;
+    if (node.bounds.Intersect(origin, ray, closest, tNear)) {
+      if (node.count) {
+        if (stats) stats->primitiveTests += node.count;
+        Real t = primitives.IntersectPrimitives(
+            &primView[node.offset], node.count, ray, closest, primIndex);
+        if (t > 0) {
+          closest = t;
+          hit = true;
+        }
+        if (!stackSize) break;
+        current = stack[--stackSize];
+      } else {
+        // Visit the child on the ray's side of the split first so later
+        // boxes get culled by the closer hit
+        if (ray.sign[node.axis]) {
+          stack[stackSize++] = current + 1;
+          current = node.offset;
+        } else {
+          stack[stackSize++] = node.offset;
+          current = current + 1;
+        }
+      }
+    } else {
+      if (!stackSize) break;
+      current = stack[--stackSize];
+    }
+  }
+
+  return hit ? closest : -1;
+}
+
+bool BVH::Occluded(const Ray &ray, const PrimitiveIntersector &primitives,
+                   TraversalStats *stats) const {
+  if (nodeView.empty()) return false;
+
+  const Vector3r origin = ray.GetOrigin();
+  unsigned stack[BVH_MAX_DEPTH];
+  unsigned stackSize = 0;
+  unsigned current = 0;
+  Real tNear;
+
+  while (true) {
+    const BVHNode &node = nodeView[current];
+    if (stats) stats->nodeVisits++;
+    if (node.bounds.Intersect(origin, ray, ray.tMax, tNear)) {
+      if (node.count) {
+        if (stats) stats->primitiveTests += node.count;
+        if (primitives.OccludePrimitives(&primView[node.offset], node.count,
+                                         ray))
+          return true;
+      } else {
+        // Same order as closest hits, blockers near the origin are found
+        // with fewer node visits
+        if (ray.sign[node.axis]) {
+          stack[stackSize++] = current + 1;
+          current = node.offset;
+        } else {
+          stack[stackSize++] = node.offset;
+          current = current + 1;
+        }
+        continue;
+      }
+    }
+    if (!stackSize) return false;
+    current = stack[--stackSize];
+  }
+}
+
+AABB BVH::GetBounds() const {
+  return nodeView.empty() ? AABB() : nodeView[0].bounds;
+}
+
+unsigned BVH::GetDepth() const { return depth; }
+
+double BVH::GetSAHCost() const {
+  if (nodeView.empty()) return 0;
+  double rootArea = nodeView[0].bounds.SurfaceArea();
+  if (rootArea <= 0) return nodeView[0].count;
+
+  double cost = 0;
+  for (const auto &node : nodeView)
+    cost += node.bounds.SurfaceArea() / rootArea *
+            (node.count ? node.count : BVH_TRAVERSAL_COST);
+  return cost;
+}
+
+const char *BVH::GetName() const {
+  return name.c_str();
+}
+
+size_t BVH::GetMemoryUsage() const {
+  return nodeView.size * sizeof(BVHNode) + primView.size * sizeof(unsigned);
+}
+
+bool BVH::Refit(const std::vector<AABB> &primBounds) {
+  // Cache files are mapped read only
+  if (nodes.empty() && !nodeView.empty()) {
+    nodes.assign(nodeView.begin(), nodeView.end());
+    primIndices.assign(primView.begin(), primView.end());
+    nodeView = nodes;
+    primView = primIndices;
+  }
+
+  auto splitRange = [&](unsigned start, unsigned end,
+                        std::vector<std::pair<unsigned, unsigned>> &children) {
+    if (nodes[start].count) return;
+    children.push_back({start + 1, nodes[start].offset});
+    children.push_back({nodes[start].offset, end});
+  };
+  auto refitNode = [&](unsigned index) {
+    BVHNode &node = nodes[index];
+    node.bounds = AABB();
+    if (node.count) {
+      for (unsigned i = node.offset; i < node.offset + node.count; i++)
+        node.bounds.Expand(primBounds[primIndices[i]]);
+    } else {
+      node.bounds.Expand(nodes[index + 1].bounds);
+      node.bounds.Expand(nodes[node.offset].bounds);
+    }
+  };
+  RefitTree(nodes.size(), splitRange, refitNode);
+  return true;
+}
+
+std::vector<DataBlock> BVH::GetArrays() const {
+  return {nodeView.ToBlock(), primView.ToBlock(), {&depth, sizeof(depth)}};
+}
+
+bool BVH::SetArrays(const std::vector<DataBlock> &arrays,
+                    const unsigned primCount) {
+  if (arrays.size() != 3 || arrays[2].size != sizeof(depth) ||
+      !nodeView.FromBlock(arrays[0]) || !primView.FromBlock(arrays[1]) ||
+      !IndicesBelow(primView, primCount))
+    return false;
+
+  // Children come after their parent, so traversal can't loop, and paths
+  // fit the traversal stack
+  std::vector<unsigned> nodeDepths(nodeView.size, 0);
+  if (!nodeDepths.empty()) nodeDepths[0] = 1;
+  for (unsigned i = 0; i < nodeView.size; i++) {
+    const BVHNode &node = nodeView[i];
+    if (node.count) {
+      if (!RangeWithin(node.offset, node.count, primView.size)) return false;
+      continue;
+    }
+    if (node.axis > 2 || i + 1 >= nodeView.size || node.offset <= i + 1 ||
+        node.offset >= nodeView.size || nodeDepths[i] >= BVH_MAX_DEPTH)
+      return false;
+    for (unsigned child : {i + 1, node.offset})
+      nodeDepths[child] = std::max(nodeDepths[child], nodeDepths[i] + 1);
+  }
+
+  nodes.clear();
+  primIndices.clear();
+  depth = *static_cast<const unsigned *>(arrays[2].data);
+  return true;
+}
+
+std::vector<unsigned> BVH::ReorderPrimitives(const unsigned primCount) {
+  // Views into a cache file are read only, and already reordered
+  if (primIndices.empty()) return {};
+  return RenumberPrimitives(primIndices, primCount);
+}
@@ -0,0 +1,87 @@
+#pragma once
+#include <string>
+#include <vector>
+#include "Accelerator.h"
+
+constexpr unsigned BVH_SAH_BINS = 16;
+constexpr unsigned BVH_MAX_LEAF_SIZE = 4;
+constexpr unsigned BVH_MAX_DEPTH = 64;  // also the traversal stack size
+constexpr double BVH_TRAVERSAL_COST = 1;  // relative to one primitive test
+constexpr unsigned SBVH_SPATIAL_BINS = 16;
+// Spatial splits are only tried where the object split children overlap by
+// more than this fraction of the root surface area
+constexpr double SBVH_OVERLAP_THRESHOLD = 1e-5;
+
+// Flattened (depth first) BVH node. The left child of an interior node is
+// always the next node in the array, so only the right child is stored
+struct BVHNode {
+  AABB bounds;
+  unsigned offset;  // first primitive (leaf) or right child (interior)
+  unsigned count;   // number of primitives, 0 for interior nodes
+  unsigned axis;    // split axis, used for front to back traversal
+};
+
+class BVH : public Accelerator {
+ public:
+  BVH(const Settings &settings_ = Settings());
+
+  // Builds the tree over the primitive bounds, primitives are only needed by
+  // the SBVH builder to split them
+  void Build(const std::vector<AABB> &primBounds,
+             const PrimitiveIntersector &primitives);
+
+  Real Intersect(const Ray &ray, const PrimitiveIntersector &primitives,
+                 unsigned &primIndex, TraversalStats *stats = nullptr) const;
+  bool Occluded(const Ray &ray, const PrimitiveIntersector &primitives,
+                TraversalStats *stats = nullptr) const;
+
+  AABB GetBounds() const;
+  const char *GetName() const;
+  size_t GetMemoryUsage() const;
+  double GetSAHCost() const;
+  unsigned GetDepth() const;
+
+  bool Refit(const std::vector<AABB> &primBounds);
+
+  std::vector<DataBlock> GetArrays() const;
+  bool SetArrays(const std::vector<DataBlock> &arrays,
+                 const unsigned primCount);
+  std::vector<unsigned> ReorderPrimitives(const unsigned primCount);
+
+  // Filled by the builders, empty when running on a cache file
+  std::vector<BVHNode> nodes;
+  std::vector<unsigned> primIndices;  // primitive order referenced by leaves
+
+ private:
+  struct BuildPrimitive {
+    AABB bounds;
+    Vector3r centroid;
+    unsigned index;
+  };
+
+  void BuildSAH(const std::vector<AABB> &primBounds);
+  unsigned BuildRecursive(std::vector<BuildPrimitive> &prims,
+                          const unsigned start, const unsigned end,
+                          const unsigned depth);
+
+  // LBVH.cpp
+  void BuildLBVH(const std::vector<AABB> &primBounds);
+
+  // SBVH.cpp
+  void BuildSBVH(const std::vector<AABB> &primBounds,
+                 const PrimitiveIntersector &primitives);
+  unsigned BuildSBVHRecursive(std::vector<BuildPrimitive> &refs,
+                              const unsigned nodeDepth, const double rootArea,
+                              size_t &duplicationBudget,
+                              const PrimitiveIntersector &primitives);
+  static void SplitReference(const BuildPrimitive &ref, const int axis,
+                             const Real position,
+                             const PrimitiveIntersector &primitives,
+                             BuildPrimitive &left, BuildPrimitive &right);
+
+  Settings settings;
+  std::string name;
+  unsigned depth = 0;
+  ArrayView<BVHNode> nodeView;
+  ArrayView<unsigned> primView;
+};
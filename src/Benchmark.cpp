@@ -0,0 +1,477 @@
+#include "Benchmark.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <limits>
+#include <numeric>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include "MeshInstance.h"
+#include "SceneAccelerator.h"
+#include "Sphere.h"
+#include "SphereKernel.h"
+#include "TriangleKernel.h"
+#include "TriangleMesh.h"
+
+namespace {
+constexpr unsigned BENCH_RESOLUTION = 512;  // primary rays per side
+constexpr unsigned BENCH_SPHERES = 100000;  // default particle field size
+constexpr unsigned BENCH_KERNEL_PRIMITIVES = 1024;  // fit in the L2 cache
+constexpr unsigned BENCH_KERNEL_RAYS = 16384;
+
+struct BenchRays {
+  const char *name;
+  std::vector<Ray> rays;
+  bool shadow;  // also traced with the any-hit query
+};
+
+// Pinhole camera looking at the model from the front and slightly above,
+// then random rays and shadow rays toward a light above leaving the visible
+// surface. intersect(ray, hit) finds the surface
+template <typename SurfaceFunc>
+std::vector<BenchRays> GenerateRays(const AABB &bounds,
+                                    const SurfaceFunc &intersect) {
+  Vector3r center = bounds.Centroid();
+  double size = (bounds.GetMax() - bounds.GetMin()).Magnitude();
+  Vector3r from = center + Vector3r(0, 0.25, 1.2) * size;
+
+  Vector3r forward = (center - from).Normalize();
+  Vector3r right = forward.Cross(Vector3r(0, 1, 0)).Normalize();
+  Vector3r up = right.Cross(forward);
+  double scale = tan(25 * M_PI / 180);
+  Vector3r light = center + Vector3r(0.3, 1, 0.4) * size;
+
+  std::vector<BenchRays> sets = {
+      {"primary", {}, false}, {"random", {}, false}, {"shadow", {}, true}};
+  std::mt19937 rng(7);
+  std::uniform_real_distribution<double> uniform(-1, 1);
+
+  for (unsigned y = 0; y < BENCH_RESOLUTION; y++) {
+    for (unsigned x = 0; x < BENCH_RESOLUTION; x++) {
+      double px = (2 * (x + 0.5) / BENCH_RESOLUTION - 1) * scale;
+      double py = (1 - 2 * (y + 0.5) / BENCH_RESOLUTION) * scale;
+      Ray ray(from, (forward + right * px + up * py).Normalize());
+      sets[0].rays.emplace_back(ray);
+
+      Hit surface;
+      if (intersect(ray, surface)) {
+        Vector3r dir;
+        do {
+          dir = Vector3r(uniform(rng), uniform(rng), uniform(rng));
+        } while (dir.Dot(dir) > 1 || dir.Dot(dir) < 1e-6);
+        dir.Normalize();
+        Vector3r hit = ray.GetOrigin() + ray.GetDirection() * surface.t;
+        sets[1].rays.emplace_back(
+            OffsetRayOrigin(hit, surface.geometricNormal, dir), dir);
+
+        Vector3r toLight = light - hit;
+        Ray shadowRay(OffsetRayOrigin(hit, surface.geometricNormal, toLight),
+                      Vector3r(toLight).Normalize());
+        shadowRay.tMax = toLight.Magnitude();
+        sets[2].rays.emplace_back(shadowRay);
+      }
+    }
+  }
+  return sets;
+}
+
+// Untimed pass with counters plus a timed pass without them, so they don't
+// skew rays/sec. hit(ray, stats) tells whether the query hit anything
+template <typename HitFunc>
+void TraceRaySet(const char *name, const char *setName,
+                 const std::vector<Ray> &rays, const HitFunc &hit) {
+  TraversalStats stats;
+  unsigned hits = 0;
+
+  auto timeStart = std::chrono::high_resolution_clock::now();
+  for (const auto &ray : rays) hits += hit(ray, nullptr);
+  auto timeEnd = std::chrono::high_resolution_clock::now();
+  for (const auto &ray : rays) hit(ray, &stats);
+
+  double seconds = std::chrono::duration<double>(timeEnd - timeStart).count();
+  double rayCount = std::max<size_t>(rays.size(), 1);
+  printf("  %-16s %-8s %8.3f Mrays/s  %7.2f nodes/ray  %7.2f "
+         "tests/ray  %u hits\n",
+         name, setName, rayCount / seconds * 1e-6, stats.nodeVisits / rayCount,
+         stats.primitiveTests / rayCount, hits);
+}
+
+// Shadow rays are traced with the closest hit query and the any-hit one, the
+// hit counts of both have to match
+template <typename IntersectFunc, typename OccludedFunc>
+void TraceRays(const char *name, const std::vector<BenchRays> &raySets,
+               const IntersectFunc &intersect, const OccludedFunc &occluded) {
+  for (const auto &raySet : raySets) {
+    TraceRaySet(name, raySet.name, raySet.rays,
+                [&intersect](const Ray &ray, TraversalStats *stats) {
+                  return intersect(ray, stats) > 0;
+                });
+    if (raySet.shadow) TraceRaySet(name, "any-hit", raySet.rays, occluded);
+  }
+}
+
+// Small spheres spread uniformly over a cube, the case grids are made for
+void BenchmarkSpheres(const unsigned count) {
+  std::cout << "\n" << count << " spheres" << std::endl;
+  std::mt19937 rng(11);
+  std::uniform_real_distribution<double> uniform(-10, 10);
+  std::uniform_real_distribution<double> radius(0.02, 0.08);
+
+  std::vector<std::shared_ptr<Object>> objects;
+  objects.reserve(count);
+  for (unsigned i = 0; i < count; i++)
+    objects.emplace_back(std::make_shared<Sphere>(
+        radius(rng), Vector3r(uniform(rng), uniform(rng), uniform(rng))));
+
+  const Accelerator::Settings configurations[] = {
+      {Accelerator::BVH2, Accelerator::SAH},
+      {Accelerator::BVH4, Accelerator::SAH},
+      {Accelerator::BVH8, Accelerator::SAH},
+      {Accelerator::GRID, Accelerator::SAH, 0, 1},
+      {Accelerator::GRID, Accelerator::SAH, 0, 2},
+      {Accelerator::KDTREE},
+  };
+
+  SceneAccelerator scene;
+  std::vector<BenchRays> raySets;
+  for (const auto &settings : configurations) {
+    auto timeStart = std::chrono::high_resolution_clock::now();
+    scene.Build(objects, settings);
+    auto timeEnd = std::chrono::high_resolution_clock::now();
+    const Accelerator *accelerator = scene.GetAccelerator();
+    printf("%s: %zu KB, built in %.1f ms\n", accelerator->GetName(),
+           accelerator->GetMemoryUsage() / 1024,
+           std::chrono::duration<double, std::milli>(timeEnd - timeStart)
+               .count());
+
+    auto intersect = [&scene](const Ray &ray, TraversalStats *stats) {
+      Hit hit;
+      return scene.Intersect(ray, hit, stats) ? hit.t : -1;
+    };
+    auto occluded = [&scene](const Ray &ray, TraversalStats *stats) {
+      return scene.Occluded(ray, ray.tMax, stats);
+    };
+    if (raySets.empty())
+      raySets = GenerateRays(accelerator->GetBounds(),
+                             [&scene](const Ray &ray, Hit &hit) {
+                               return scene.Intersect(ray, hit);
+                             });
+    TraceRays(accelerator->GetName(), raySets, intersect, occluded);
+  }
+}
+
+// Time of shooting every ray at every leaf of leafSize triangles from
+// indices, and the hit count and distance sum to compare the kernels by
+template <typename KernelFunc>
+double TimeKernel(const std::vector<Ray> &rays,
+                  const std::vector<unsigned> &indices, const unsigned leafSize,
+                  const KernelFunc &kernel, unsigned &hits, double &sum) {
+  hits = 0;
+  sum = 0;
+  auto timeStart = std::chrono::high_resolution_clock::now();
+  for (const auto &ray : rays)
+    for (unsigned first = 0; first < indices.size(); first += leafSize) {
+      unsigned hitIndex = 0;
+      Real t = kernel(&indices[first], leafSize, ray, ray.tMax, hitIndex);
+      if (t > 0) {
+        hits++;
+        sum += t + hitIndex;
+      }
+    }
+  auto timeEnd = std::chrono::high_resolution_clock::now();
+  return std::chrono::duration<double>(timeEnd - timeStart).count();
+}
+
+// Kernels doing the same operations can still round differently under
+// -Ofast (contraction, reassociation), so their results are compared to a
+// few hundred ulps of Real. Rays grazing an edge or a silhouette may flip
+// with the rounding, which only single precision makes frequent enough to see
+bool KernelsAgree(const unsigned hitsA, const double sumA, const unsigned hitsB,
+                  const double sumB) {
+  const double tolerance = 1e3 * std::numeric_limits<Real>::epsilon();
+  return std::fabs(double(hitsA) - hitsB) <= tolerance * hitsB &&
+         std::fabs(sumA - sumB) <= tolerance * sumB;
+}
+
+// From a sphere around the unit cube through a random point in it
+std::vector<Ray> GenerateKernelRays(std::mt19937 &rng) {
+  std::uniform_real_distribution<double> uniform(-1, 1);
+  std::vector<Ray> rays;
+  while (rays.size() < BENCH_KERNEL_RAYS) {
+    Vector3r from(uniform(rng), uniform(rng), uniform(rng));
+    if (from.Dot(from) > 1 || from.Dot(from) < 1e-6) continue;
+    from = Vector3r(from).Normalize() * 3;
+    Vector3r to(uniform(rng), uniform(rng), uniform(rng));
+    rays.emplace_back(from, (to - from).Normalize());
+  }
+  return rays;
+}
+
+// Batched triangle kernel against the scalar one, on leaves of consecutive
+// triangles (reordered meshes) and of scattered ones (duplicated references)
+void BenchmarkTriangleKernel() {
+  std::cout << "\ntriangle kernel, " << TRIANGLE_LANES << " lanes"
+            << std::endl;
+  std::mt19937 rng(3);
+  std::uniform_real_distribution<double> uniform(-1, 1);
+
+  TriangleArrays arrays;
+  arrays.resize(BENCH_KERNEL_PRIMITIVES);
+  for (unsigned i = 0; i < BENCH_KERNEL_PRIMITIVES; i++)
+    for (unsigned axis = 0; axis < 3; axis++) {
+      arrays.v0[axis][i] = uniform(rng);
+      arrays.edge1[axis][i] = uniform(rng) * 0.5;
+      arrays.edge2[axis][i] = uniform(rng) * 0.5;
+    }
+  const TriangleArrayView triangles(arrays);
+
+  std::vector<Ray> rays = GenerateKernelRays(rng);
+  std::vector<unsigned> consecutive(BENCH_KERNEL_PRIMITIVES);
+  std::iota(consecutive.begin(), consecutive.end(), 0);
+  std::vector<unsigned> scattered = consecutive;
+  std::shuffle(scattered.begin(), scattered.end(), rng);
+
+  auto scalar = [&triangles](const unsigned *indices, unsigned count,
+                             const Ray &ray, Real closest, unsigned &hit) {
+    return IntersectTrianglesScalar(triangles, indices, count, ray, closest,
+                                    hit);
+  };
+  auto batched = [&triangles](const unsigned *indices, unsigned count,
+                              const Ray &ray, Real closest, unsigned &hit) {
+    return IntersectTriangles(triangles, indices, count, ray, closest, hit);
+  };
+
+  const double tests = double(BENCH_KERNEL_RAYS) * BENCH_KERNEL_PRIMITIVES;
+  for (unsigned leafSize : {4u, 8u})
+    for (const auto &order : {std::make_pair("consecutive", &consecutive),
+                              std::make_pair("scattered", &scattered)}) {
+      unsigned scalarHits, batchedHits;
+      double scalarSum, batchedSum;
+      double scalarTime = TimeKernel(rays, *order.second, leafSize, scalar,
+                                     scalarHits, scalarSum);
+      double batchedTime = TimeKernel(rays, *order.second, leafSize, batched,
+                                      batchedHits, batchedSum);
+      printf("  leaf %u %-12s scalar %8.1f Mtests/s  batched %8.1f "
+             "Mtests/s  %5.2fx  %u hits%s\n",
+             leafSize, order.first, tests / scalarTime * 1e-6,
+             tests / batchedTime * 1e-6, scalarTime / batchedTime,
+             batchedHits,
+             KernelsAgree(scalarHits, scalarSum, batchedHits, batchedSum)
+                 ? ""
+                 : "  MISMATCH");
+    }
+}
+
+// Batched sphere kernel against the scalar one and against a virtual
+// Object::Intersect call per sphere, the way scenes tested them before
+void BenchmarkSphereKernel() {
+  std::cout << "\nsphere kernel, " << SPHERE_LANES << " lanes" << std::endl;
+  std::mt19937 rng(13);
+  std::uniform_real_distribution<double> uniform(-1, 1);
+  std::uniform_real_distribution<double> radius(0.02, 0.2);
+
+  SphereArrays spheres;
+  std::vector<std::shared_ptr<Object>> objects;
+  for (unsigned i = 0; i < BENCH_KERNEL_PRIMITIVES; i++) {
+    Vector3r center(uniform(rng), uniform(rng), uniform(rng));
+    double r = radius(rng);
+    spheres.push_back(center, r);
+    objects.emplace_back(std::make_shared<Sphere>(r, center));
+  }
+  std::vector<Ray> rays = GenerateKernelRays(rng);
+  std::vector<unsigned> indices(BENCH_KERNEL_PRIMITIVES);
+  std::iota(indices.begin(), indices.end(), 0);
+
+  auto object = [&objects](const unsigned *indices, unsigned count,
+                           const Ray &ray, Real closest, unsigned &hit) {
+    Real result = -1;
+    for (unsigned i = 0; i < count; i++) {
+      Hit record;
+      if (objects[indices[i]]->Intersect(ray, record) && record.t < closest) {
+        closest = result = record.t;
+        hit = indices[i];
+      }
+    }
+    return result;
+  };
+  auto scalar = [&spheres](const unsigned *indices, unsigned count,
+                           const Ray &ray, Real closest, unsigned &hit) {
+    return IntersectSpheresScalar(spheres, indices, count, ray, closest, hit);
+  };
+  auto batched = [&spheres](const unsigned *indices, unsigned count,
+                            const Ray &ray, Real closest, unsigned &hit) {
+    return IntersectSpheres(spheres, indices, count, ray, closest, hit);
+  };
+
+  const double tests = double(BENCH_KERNEL_RAYS) * BENCH_KERNEL_PRIMITIVES;
+  for (unsigned leafSize : {4u, 8u}) {
+    unsigned objectHits, scalarHits, batchedHits;
+    double objectSum, scalarSum, batchedSum;
+    double objectTime =
+        TimeKernel(rays, indices, leafSize, object, objectHits, objectSum);
+    double scalarTime =
+        TimeKernel(rays, indices, leafSize, scalar, scalarHits, scalarSum);
+    double batchedTime =
+        TimeKernel(rays, indices, leafSize, batched, batchedHits, batchedSum);
+    const bool mismatch =
+        !KernelsAgree(objectHits, objectSum, batchedHits, batchedSum) ||
+        !KernelsAgree(scalarHits, scalarSum, batchedHits, batchedSum);
+    printf("  leaf %u  per object %8.1f Mtests/s  scalar %8.1f Mtests/s  "
+           "batched %8.1f Mtests/s  %5.2fx  %u hits%s\n",
+           leafSize, tests / objectTime * 1e-6, tests / scalarTime * 1e-6,
+           tests / batchedTime * 1e-6, objectTime / batchedTime, batchedHits,
+           mismatch ? "  MISMATCH" : "");
+    if (mismatch)
+      printf("    per object %u hits, scalar %u hits\n", objectHits,
+             scalarHits);
+  }
+}
+
+// Scene level accelerator over the instances, the mesh accelerator below
+// them is shared
+void BenchmarkInstances(const unsigned count, const char *file) {
+  std::cout << "\n" << count << " instances of " << file << std::endl;
+  auto mesh = std::make_shared<TriangleMesh>(file);
+  AABB bounds;
+  mesh->GetBounds(bounds);
+  double size = (bounds.GetMax() - bounds.GetMin()).Magnitude();
+
+  // Instances on a square grid, one mesh size apart
+  std::mt19937 rng(5);
+  std::uniform_real_distribution<double> uniform(0, 1);
+  unsigned side = std::ceil(std::sqrt(double(count)));
+  std::vector<std::shared_ptr<Object>> objects;
+  for (unsigned i = 0; i < count; i++) {
+    double angle = uniform(rng) * 2 * M_PI, scale = 0.5 + uniform(rng) * 0.5;
+    double c = cos(angle) * scale, s = sin(angle) * scale;
+    Matrix44r objectToWorld(c, 0, -s, 0, 0, scale, 0, 0, s, 0, c, 0,
+                            (i % side) * size, 0, (i / side) * size, 1);
+    objects.emplace_back(std::make_shared<MeshInstance>(mesh, objectToWorld));
+  }
+
+  size_t meshBytes = mesh->GetMemoryUsage();
+  printf("mesh %zu KB + instances %zu KB, separate meshes would take %zu KB\n",
+         meshBytes / 1024, count * sizeof(MeshInstance) / 1024,
+         count * meshBytes / 1024);
+
+  const Accelerator::Settings configurations[] = {
+      {Accelerator::BVH2, Accelerator::SAH},
+      {Accelerator::BVH8, Accelerator::SAH},
+  };
+
+  SceneAccelerator scene;
+  std::vector<BenchRays> raySets;
+  for (const auto &settings : configurations) {
+    scene.Build(objects, settings);
+    auto intersect = [&scene](const Ray &ray, TraversalStats *stats) {
+      Hit hit;
+      return scene.Intersect(ray, hit, stats) ? hit.t : -1;
+    };
+    auto occluded = [&scene](const Ray &ray, TraversalStats *stats) {
+      return scene.Occluded(ray, ray.tMax, stats);
+    };
+    if (raySets.empty())
+      raySets = GenerateRays(scene.GetAccelerator()->GetBounds(),
+                             [&scene](const Ray &ray, Hit &hit) {
+                               return scene.Intersect(ray, hit);
+                             });
+    TraceRays(scene.GetAccelerator()->GetName(), raySets, intersect,
+              occluded);
+  }
+}
+
+void BenchmarkMesh(const char *file) {
+  std::cout << "\n" << file << std::endl;
+  TriangleMesh mesh(file);
+
+  const Accelerator::Settings configurations[] = {
+      {Accelerator::BVH2, Accelerator::SAH},
+      {Accelerator::BVH4, Accelerator::SAH},
+      {Accelerator::BVH8, Accelerator::SAH},
+      {Accelerator::BVH2, Accelerator::LBVH},
+      {Accelerator::BVH8, Accelerator::LBVH},
+      {Accelerator::BVH2, Accelerator::SBVH},
+      {Accelerator::BVH8, Accelerator::SBVH},
+      {Accelerator::GRID, Accelerator::SAH, 0, 1},
+      {Accelerator::GRID, Accelerator::SAH, 0, 2},
+      {Accelerator::KDTREE},
+  };
+
+  auto intersect = [&mesh](const Ray &ray, TraversalStats *stats) {
+    unsigned face;
+    return mesh.IntersectFaces(ray, face, stats);
+  };
+  auto occluded = [&mesh](const Ray &ray, TraversalStats *stats) {
+    return mesh.OccludedFaces(ray, stats);
+  };
+  AABB bounds;
+  mesh.GetBounds(bounds);
+  std::vector<BenchRays> raySets =
+      GenerateRays(bounds, [&mesh](const Ray &ray, Hit &hit) {
+        return mesh.Intersect(ray, hit);
+      });
+
+  for (const auto &settings : configurations) {
+    mesh.BuildAccelerator(settings);
+    TraceRays(mesh.GetAccelerator().GetName(), raySets, intersect, occluded);
+  }
+}
+
+void PrintUsage() {
+  std::cerr << "usage: tracey bench <model.obj | spheres[:count] | "
+               "instances:count:model.obj | kernel> [...]"
+            << std::endl;
+}
+
+// Positive whole number, false for anything else
+bool ParseCount(const std::string &text, unsigned &count) {
+  size_t end = 0;
+  unsigned long value;
+  try {
+    value = std::stoul(text, &end);
+  } catch (const std::exception &) {
+    return false;
+  }
+  if (end != text.size() || value == 0 ||
+      value > std::numeric_limits<unsigned>::max())
+    return false;
+  count = unsigned(value);
+  return true;
+}
+}  // namespace
+
+int RunBenchmarks(int argc, char *argv[]) {
+  if (argc < 1) {
+    PrintUsage();
+    return 1;
+  }
+
+  for (int model = 0; model < argc; model++) {
+    std::string arg = argv[model];
+    if (arg.compare(0, 10, "instances:") == 0) {
+      size_t separator = arg.find(':', 10);
+      unsigned count;
+      if (separator == std::string::npos ||
+          !ParseCount(arg.substr(10, separator - 10), count)) {
+        PrintUsage();
+        return 1;
+      }
+      BenchmarkInstances(count, arg.c_str() + separator + 1);
+    } else if (arg == "kernel") {
+      BenchmarkTriangleKernel();
+      BenchmarkSphereKernel();
+    } else if (arg.compare(0, 7, "spheres") == 0) {
+      unsigned count = BENCH_SPHERES;
+      if (arg.size() > 7 &&
+          (arg[7] != ':' || !ParseCount(arg.substr(8), count))) {
+        PrintUsage();
+        return 1;
+      }
+      BenchmarkSpheres(count);
+    } else
+      BenchmarkMesh(argv[model]);
+  }
+  return 0;
+}
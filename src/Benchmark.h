@@ -0,0 +1,12 @@
+#pragma once
+
+// Accelerator benchmark:
+//   tracey bench <model.obj | spheres[:count] | instances:count:model.obj |
+//                 kernel> [...]
+// Shoots the same primary and random rays at every model through each
+// accelerator and prints rays/sec, node visits and primitive tests per ray.
+// "spheres" is a scene level particle field of uniformly spread spheres,
+// "instances" a field of randomly turned and scaled copies of one mesh.
+// "kernel" times the batched triangle and sphere leaf kernels against the
+// scalar ones
+int RunBenchmarks(int argc, char *argv[]);
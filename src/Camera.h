@@ -5,39 +5,39 @@
 class Camera {
  public:
   Camera();
-  Camera(const Vector3d &from, const Vector3d &to);
-  Vector3d GetFrom();
-  Vector3d GetTo();
-  Vector3d GetForward();
-  Vector3d GetRight();
-  Vector3d GetUp();
-  void SetTo(const Vector3d &to_);
+  Camera(const Vector3r &from, const Vector3r &to);
+  Vector3r GetFrom();
+  Vector3r GetTo();
+  Vector3r GetForward();
+  Vector3r GetRight();
+  Vector3r GetUp();
+  void SetTo(const Vector3r &to_);
 
  private:
-  Vector3d from;
-  Vector3d to;
-  Vector3d tmp = Vector3d(0, 1, 0);
+  Vector3r from;
+  Vector3r to;
+  Vector3r tmp = Vector3r(0, 1, 0);
 
   // Camera coordinates
-  Vector3d forward =
+  Vector3r forward =
       (from - to).Normalize();  // Where camera's view is centered
-  Vector3d right = (tmp.Normalize()).Cross(forward);
-  Vector3d up = forward.Cross(right);
+  Vector3r right = (tmp.Normalize()).Cross(forward);
+  Vector3r up = forward.Cross(right);
 };
 
 Camera::Camera() : from{0}, to{0, 0, -1} {}
 
-inline Camera::Camera(const Vector3d &from, const Vector3d &to)
+inline Camera::Camera(const Vector3r &from, const Vector3r &to)
     : from(from), to(to) {}
 
-inline Vector3d Camera::GetFrom() { return from; }
+inline Vector3r Camera::GetFrom() { return from; }
 
-inline Vector3d Camera::GetTo() { return to; }
+inline Vector3r Camera::GetTo() { return to; }
 
-inline Vector3d Camera::GetForward() { return forward; }
+inline Vector3r Camera::GetForward() { return forward; }
 
-inline Vector3d Camera::GetRight() { return right; }
+inline Vector3r Camera::GetRight() { return right; }
 
-inline Vector3d Camera::GetUp() { return up; }
+inline Vector3r Camera::GetUp() { return up; }
 
-void Camera::SetTo(const Vector3d &to_) { to = to_; }
+void Camera::SetTo(const Vector3r &to_) { to = to_; }
@@ -0,0 +1,58 @@
+#include "CellOrder.h"
+#include <utility>
+
+namespace {
+// Every other bit of v, the inverse of interleaving
+unsigned CompactBits(unsigned v) {
+  v &= 0x55555555;
+  v = (v | v >> 1) & 0x33333333;
+  v = (v | v >> 2) & 0x0f0f0f0f;
+  v = (v | v >> 4) & 0x00ff00ff;
+  v = (v | v >> 8) & 0x0000ffff;
+  return v;
+}
+
+// Position d along the Hilbert curve over a side x side square
+void HilbertCell(const unsigned side, unsigned d, unsigned &x, unsigned &y) {
+  x = y = 0;
+  for (unsigned s = 1; s < side; s *= 2) {
+    unsigned rx = 1 & (d / 2);
+    unsigned ry = 1 & (d ^ rx);
+    // Rotate the quadrant so the sub-curves join up
+    if (ry == 0) {
+      if (rx == 1) {
+        x = s - 1 - x;
+        y = s - 1 - y;
+      }
+      std::swap(x, y);
+    }
+    x += s * rx;
+    y += s * ry;
+    d /= 4;
+  }
+}
+}  // namespace
+
+std::vector<unsigned> OrderCells(const unsigned width, const unsigned height,
+                                 const CellOrder order) {
+  std::vector<unsigned> cells;
+  cells.reserve(width * height);
+  if (order == CellOrder::Scanline) {
+    for (unsigned cell = 0; cell < width * height; cell++)
+      cells.emplace_back(cell);
+    return cells;
+  }
+
+  unsigned side = 1;
+  while (side < width || side < height) side *= 2;
+  for (unsigned d = 0; d < side * side; d++) {
+    unsigned x, y;
+    if (order == CellOrder::Morton) {
+      x = CompactBits(d);
+      y = CompactBits(d >> 1);
+    } else
+      HilbertCell(side, d, x, y);
+    if (x < width && y < height) cells.emplace_back(y * width + x);
+  }
+  return cells;
+}
@@ -0,0 +1,20 @@
+#pragma once
+#include <vector>
+
+// Order the cells of a grid are visited in
+enum class CellOrder {
+  Scanline,  // rows, left to right
+  Morton,    // Z-order curve
+  Hilbert    // Hilbert curve, consecutive cells are always neighbours
+};
+// Order tiles are handed out to the render threads in, and order of the
+// pixels inside a tile. Along a curve consecutive primary rays stay close,
+// so they keep visiting the same acceleration structure nodes and triangles
+constexpr CellOrder TILE_ORDER = CellOrder::Hilbert;
+constexpr CellOrder PIXEL_ORDER = CellOrder::Morton;
+
+// Cells of a width x height grid, as y * width + x, in the given order.
+// Curves cover the enclosing power of two square, cells outside the grid
+// are skipped
+std::vector<unsigned> OrderCells(const unsigned width, const unsigned height,
+                                 const CellOrder order);
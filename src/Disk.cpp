@@ -2,25 +2,41 @@
 
 Disk::Disk() {
   radius = 1;
-  position = Vector3d(0, 1, 8);
-  normal = Vector3d(0, 0, 1);
+  position = Vector3r(0, 1, 8);
+  normal = Vector3r(0, 0, 1);
 }
 
-Disk::Disk(double radius_, Vector3d position_, Vector3d normal_)
-    : radius{radius_}, position{position_}, normal{normal_} {}
-
-double Disk::GetIntersection(const Ray &ray) {
-  if (Plane::GetIntersectionDisk(ray, normal, position)) {
-    double t = Plane::GetIntersectionDisk(ray, normal, position);
-    Vector3d intersectionPoint = ray.GetOrigin() + ray.GetDirection() * t;
-    Vector3d intersectionToMidDist = intersectionPoint - position;
-    double d2 = intersectionToMidDist.Dot(intersectionToMidDist);
-    double radius2 = radius * radius;
-    return (d2 <= radius2);
-  } else
-    return false;
+Disk::Disk(Real radius_, Vector3r position_, Vector3r normal_)
+    : position{position_}, normal{normal_}, radius{radius_} {}
+
+bool Disk::Intersect(const Ray &ray, Hit &hit) const {
+  return Intersect(position, normal, radius, ray, hit);
+}
+
+bool Disk::Intersect(const Vector3r &position, const Vector3r &normal,
+                     const Real radius, const Ray &ray, Hit &hit) {
+  Real t = Plane::GetIntersectionDisk(ray, normal, position);
+  if (t <= BIAS || t >= ray.tMax) return false;
+
+  Vector3r intersectionPoint = ray.GetOrigin() + ray.GetDirection() * t;
+  Vector3r intersectionToMidDist = intersectionPoint - position;
+  Real d2 = intersectionToMidDist.Dot(intersectionToMidDist);
+  if (d2 > radius * radius) return false;
+
+  hit.t = t;
+  hit.normal = hit.geometricNormal = normal;
+  return true;
 }
 
-Vector3d Disk::GetNormalAt(const Vector3d &) { return normal; }
+bool Disk::GetBounds(AABB &bounds) const {
+  // Extent of a disk along an axis is radius * sin(angle to the normal)
+  Vector3r n = normal;
+  n.Normalize();
+  Vector3r extent(radius * sqrt(std::max(Real(0), 1 - n.x * n.x)),
+                  radius * sqrt(std::max(Real(0), 1 - n.y * n.y)),
+                  radius * sqrt(std::max(Real(0), 1 - n.z * n.z)));
+  bounds = AABB(position - extent, position + extent);
+  return true;
+}
 
-Vector3d Disk::GetPosition() const { return position; }
+Vector3r Disk::GetPosition() const { return position; }
@@ -7,14 +7,19 @@
 class Disk : public Plane {
  public:
   Disk();
-  Disk(double radius_, Vector3d position_, Vector3d normal_);
-  double GetIntersection(const Ray &ray);
-
-  Vector3d GetNormalAt(const Vector3d &point);
-  Vector3d GetPosition() const;
+  Disk(Real radius_, Vector3r position_, Vector3r normal_);
+  bool Intersect(const Ray &ray, Hit &hit) const;
+  // Shared with the flat disk array of SceneAccelerator
+  static bool Intersect(const Vector3r &position, const Vector3r &normal,
+                        const Real radius, const Ray &ray, Hit &hit);
+  bool GetBounds(AABB &bounds) const;
+  size_t GetMemoryUsage() const { return sizeof(Disk); }
+  Vector3r GetPosition() const;
+  Vector3r GetNormal() const { return normal; }
+  Real GetRadius() const { return radius; }
 
  private:
-  Vector3d position;
-  Vector3d normal;
-  double radius;
+  Vector3r position;
+  Vector3r normal;
+  Real radius;
 };
@@ -1,15 +1,33 @@
 #pragma once
 
+// Precision of rays, geometry and acceleration structures. Shading stays in
+// double. Building with PRECISION=float (TRACEY_SINGLE_PRECISION) halves the
+// memory they take and doubles the lanes of the SIMD leaf kernels
+#ifdef TRACEY_SINGLE_PRECISION
+typedef float Real;
+#else
+typedef double Real;
+#endif
+
 constexpr unsigned int WIDTH = 1920;
 constexpr unsigned int HEIGHT = 1080;
 
 constexpr double AMBIENT_LIGHT = 0.6;
 constexpr double GLOBAL_REFRACTION = 1;  // 1 = air / vacuum;
-constexpr double BIAS = 1e-8;
+// Smallest distance accepted as a hit. Secondary rays don't rely on it to
+// miss the surface they leave, see OffsetRayOrigin
+constexpr Real BIAS = 1e-8;
 constexpr unsigned SUPERSAMPLING = 1;
 constexpr unsigned DEPTH =
     15;  // not checking for hall of mirrors effect try allocating more memory
 constexpr unsigned FOV = 50;
+// Threads render the image in TILE_SIZE x TILE_SIZE pixel tiles, each taking
+// the next tile left once it finishes one, so expensive regions of the scene
+// don't hold the render up on a single thread
+constexpr unsigned TILE_SIZE = 32;
+// Worker threads of the thread pool rendering and building acceleration
+// structures, 0 starts one per hardware thread
+constexpr unsigned THREADS = 0;
 
 constexpr bool REFRACTIONS_ON = true;
 constexpr bool REFLECTIONS_ON = true;
@@ -19,6 +37,9 @@ constexpr bool DIFFUSE_ON = true;
 constexpr bool AMBIENT_ON = true;
 
 constexpr bool SMOOTH_SHADING = true;
+// Shadow rays first try the object that blocked the thread's last shadow ray
+// toward the same light
+constexpr bool SHADOW_CACHE_ON = true;
 
 // This ray tracer uses a Left hand coordinate system,
 // with x pointing to the right, y up and z coming out from the screen
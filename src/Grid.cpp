@@ -0,0 +1,314 @@
+#include "Grid.h"
+#include <atomic>
+#include <cmath>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace {
+std::atomic<uint64_t> nextGridId(1);
+
+// Ids of the grids alive, mailboxes of the others are dropped
+std::mutex liveGridsMutex;
+std::unordered_set<uint64_t> liveGrids;
+
+// Last ray id that tested each primitive, one per grid and thread so the
+// traversal stays const and lock free
+struct Mailbox {
+  uint32_t rayId = 0;
+  std::vector<uint32_t> stamps;
+};
+
+// Mailboxes are held by pointer so they stay put when a nested query on
+// another grid (a grid accelerated mesh in a grid accelerated scene) adds
+// its own while the outer query uses one
+Mailbox &GetMailbox(const uint64_t gridId, const unsigned primCount) {
+  thread_local std::unordered_map<uint64_t, std::unique_ptr<Mailbox>>
+      mailboxes;
+  auto found = mailboxes.find(gridId);
+  if (found == mailboxes.end()) {
+    // First ray of a grid on this thread, drop those of destroyed grids
+    {
+      std::lock_guard<std::mutex> lock(liveGridsMutex);
+      for (auto it = mailboxes.begin(); it != mailboxes.end();)
+        it = liveGrids.count(it->first) ? std::next(it) : mailboxes.erase(it);
+    }
+    found =
+        mailboxes.emplace(gridId, std::unique_ptr<Mailbox>(new Mailbox)).first;
+  }
+
+  // Rebuilt grids keep their id. Ray ids only grow, so stamps left by
+  // earlier rays never match, only a new primitive count needs new stamps
+  Mailbox &mailbox = *found->second;
+  if (mailbox.stamps.size() != primCount) {
+    mailbox.stamps.assign(primCount, 0);
+    mailbox.rayId = 0;
+  }
+  return mailbox;
+}
+}  // namespace
+
+Grid::Grid(const Settings &settings_)
+    : settings{settings_}, id{nextGridId++} {
+  std::lock_guard<std::mutex> lock(liveGridsMutex);
+  liveGrids.insert(id);
+}
+
+Grid::~Grid() {
+  std::lock_guard<std::mutex> lock(liveGridsMutex);
+  liveGrids.erase(id);
+}
+
+void Grid::Build(const std::vector<AABB> &primBounds,
+                 const PrimitiveIntersector &) {
+  BuildCells(primBounds);
+}
+
+bool Grid::Refit(const std::vector<AABB> &primBounds) {
+  BuildCells(primBounds);
+  return true;
+}
+
+void Grid::BuildCells(const std::vector<AABB> &primBounds) {
+  levels.clear();
+  primCount = primBounds.size();
+  if (primBounds.empty()) return;
+
+  AABB bounds;
+  std::vector<unsigned> prims(primBounds.size());
+  for (unsigned i = 0; i < primBounds.size(); i++) {
+    bounds.Expand(primBounds[i]);
+    prims[i] = i;
+  }
+  // Padding keeps flat scenes (and flat axes) out of zero sized cells
+  Vector3r extent = bounds.GetMax() - bounds.GetMin();
+  double pad = std::max(extent.x, std::max(extent.y, extent.z)) * 1e-5 + 1e-9;
+  bounds = AABB(bounds.GetMin() - Vector3r(pad),
+                bounds.GetMax() + Vector3r(pad));
+
+  levels.emplace_back();
+  BuildLevel(levels[0], bounds, prims, primBounds);
+  levels[0].subgrid.assign(levels[0].cellStart.size() - 1, -1);
+  if (settings.gridLevels < 2) return;
+
+  // Second level for crowded cells, the levels vector grows so the top
+  // level is indexed again every time
+  for (unsigned cell = 0; cell + 1 < levels[0].cellStart.size(); cell++) {
+    unsigned start = levels[0].cellStart[cell];
+    unsigned end = levels[0].cellStart[cell + 1];
+    if (end - start <= GRID_SUBGRID_THRESHOLD) continue;
+
+    const int res0 = levels[0].resolution[0], res1 = levels[0].resolution[1];
+    const int x = cell % res0, y = (cell / res0) % res1,
+              z = cell / (res0 * res1);
+    const Vector3r cellMin =
+        levels[0].bounds.bounds[0] +
+        levels[0].cellSize * Vector3r(x, y, z);
+    AABB cellBounds(cellMin, cellMin + levels[0].cellSize);
+
+    std::vector<unsigned> cellPrims(levels[0].cellPrims.begin() + start,
+                                    levels[0].cellPrims.begin() + end);
+    Level level;
+    BuildLevel(level, cellBounds, cellPrims, primBounds);
+    levels.emplace_back(std::move(level));
+    levels[0].subgrid[cell] = levels.size() - 1;
+  }
+}
+
+void Grid::BuildLevel(Level &level, const AABB &bounds,
+                      const std::vector<unsigned> &prims,
+                      const std::vector<AABB> &primBounds) {
+  level.bounds = bounds;
+
+  // Cell size so the grid holds about GRID_DENSITY cells per primitive
+  Vector3r extent = bounds.GetMax() - bounds.GetMin();
+  double volume = extent.x * extent.y * extent.z;
+  double cellsPerUnit = std::cbrt(GRID_DENSITY * prims.size() / volume);
+
+  for (uint8_t axis = 0; axis < 3; axis++) {
+    int resolution = int(std::ceil(extent[axis] * cellsPerUnit));
+    level.resolution[axis] =
+        std::max(1, std::min(resolution, GRID_MAX_RESOLUTION));
+    level.cellSize[axis] = extent[axis] / level.resolution[axis];
+    level.invCellSize[axis] = 1 / level.cellSize[axis];
+  }
+
+  const int *res = level.resolution;
+  auto cellRange = [&](const AABB &box, int lo[3], int hi[3]) {
+    for (uint8_t axis = 0; axis < 3; axis++) {
+      lo[axis] = int((box.bounds[0][axis] - bounds.bounds[0][axis]) *
+                     level.invCellSize[axis]);
+      hi[axis] = int((box.bounds[1][axis] - bounds.bounds[0][axis]) *
+                     level.invCellSize[axis]);
+      lo[axis] = std::max(0, std::min(lo[axis], res[axis] - 1));
+      hi[axis] = std::max(0, std::min(hi[axis], res[axis] - 1));
+    }
+  };
+
+  // Count, prefix sum, fill
+  const unsigned cells = res[0] * res[1] * res[2];
+  level.cellStart.assign(cells + 1, 0);
+  int lo[3], hi[3];
+  for (unsigned prim : prims) {
+    cellRange(primBounds[prim], lo, hi);
+    for (int z = lo[2]; z <= hi[2]; z++)
+      for (int y = lo[1]; y <= hi[1]; y++)
+        for (int x = lo[0]; x <= hi[0]; x++)
+          level.cellStart[(z * res[1] + y) * res[0] + x + 1]++;
+  }
+  for (unsigned cell = 0; cell < cells; cell++)
+    level.cellStart[cell + 1] += level.cellStart[cell];
+
+  level.cellPrims.resize(level.cellStart[cells]);
+  std::vector<unsigned> fill(level.cellStart.begin(),
+                             level.cellStart.end() - 1);
+  for (unsigned prim : prims) {
+    cellRange(primBounds[prim], lo, hi);
+    for (int z = lo[2]; z <= hi[2]; z++)
+      for (int y = lo[1]; y <= hi[1]; y++)
+        for (int x = lo[0]; x <= hi[0]; x++)
+          level.cellPrims[fill[(z * res[1] + y) * res[0] + x]++] = prim;
+  }
+}
+
+Real Grid::Intersect(const Ray &ray, const PrimitiveIntersector &primitives,
+                     unsigned &primIndex, TraversalStats *stats) const {
+  return March(ray, primitives, false, primIndex, stats);
+}
+
+bool Grid::Occluded(const Ray &ray, const PrimitiveIntersector &primitives,
+                    TraversalStats *stats) const {
+  unsigned primIndex;
+  return March(ray, primitives, true, primIndex, stats) >= 0;
+}
+
+Real Grid::March(const Ray &ray, const PrimitiveIntersector &primitives,
+                 const bool anyHit, unsigned &primIndex,
+                 TraversalStats *stats) const {
+  if (levels.empty()) return -1;
+
+  Real tStart;
+  const Vector3r origin = ray.GetOrigin();
+  if (!levels[0].bounds.Intersect(origin, ray, ray.tMax, tStart)) return -1;
+  Real tEnd = ray.tMax;
+  for (uint8_t axis = 0; axis < 3; axis++) {
+    Real tFar =
+        (levels[0].bounds.bounds[1 - ray.sign[axis]][axis] - origin[axis]) *
+        ray.invDir[axis];
+    tEnd = std::min(tEnd, tFar);
+  }
+
+  Mailbox &mailbox = GetMailbox(id, primCount);
+  if (++mailbox.rayId == 0) {
+    std::fill(mailbox.stamps.begin(), mailbox.stamps.end(), 0);
+    mailbox.rayId = 1;
+  }
+
+  Real closest = ray.tMax;
+  TraverseLevel(levels[0], ray, tStart, tEnd, primitives, anyHit, closest,
+                primIndex, mailbox.stamps, mailbox.rayId, stats);
+  return (closest < ray.tMax) ? closest : -1;
+}
+
+void Grid::TraverseLevel(const Level &level, const Ray &ray,
+                         const Real tStart, const Real tEnd,
+                         const PrimitiveIntersector &primitives,
+                         const bool anyHit, Real &closest, unsigned &primIndex,
+                         std::vector<uint32_t> &mailbox, const uint32_t rayId,
+                         TraversalStats *stats) const {
+  const Vector3r origin = ray.GetOrigin();
+  const Vector3r direction = ray.GetDirection();
+  const Vector3r entry = origin + direction * tStart;
+
+  // 3D-DDA setup: current cell, distance to its next boundary on every
+  // axis and the distance between boundaries
+  int cell[3], step[3], stop[3];
+  Real tNext[3], tDelta[3];
+  for (uint8_t axis = 0; axis < 3; axis++) {
+    int c = int((entry[axis] - level.bounds.bounds[0][axis]) *
+                level.invCellSize[axis]);
+    cell[axis] = std::max(0, std::min(c, level.resolution[axis] - 1));
+    Real cellMin =
+        level.bounds.bounds[0][axis] + cell[axis] * level.cellSize[axis];
+    if (ray.sign[axis]) {
+      tNext[axis] = tStart + (cellMin - entry[axis]) * ray.invDir[axis];
+      tDelta[axis] = -level.cellSize[axis] * ray.invDir[axis];
+      step[axis] = -1;
+      stop[axis] = -1;
+    } else {
+      tNext[axis] = tStart + (cellMin + level.cellSize[axis] - entry[axis]) *
+                                 ray.invDir[axis];
+      tDelta[axis] = level.cellSize[axis] * ray.invDir[axis];
+      step[axis] = 1;
+      stop[axis] = level.resolution[axis];
+    }
+  }
+
+  Real tEnter = tStart;
+  while (true) {
+    const Real tExit =
+        std::min(std::min(tNext[0], tNext[1]), std::min(tNext[2], tEnd));
+    const unsigned cellIndex =
+        (cell[2] * level.resolution[1] + cell[1]) * level.resolution[0] +
+        cell[0];
+    if (stats) stats->nodeVisits++;
+
+    if (!level.subgrid.empty() && level.subgrid[cellIndex] >= 0) {
+      TraverseLevel(levels[level.subgrid[cellIndex]], ray, tEnter, tExit,
+                    primitives, anyHit, closest, primIndex, mailbox, rayId,
+                    stats);
+    } else {
+      for (unsigned i = level.cellStart[cellIndex];
+           i < level.cellStart[cellIndex + 1]; i++) {
+        const unsigned prim = level.cellPrims[i];
+        if (mailbox[prim] == rayId) continue;
+        mailbox[prim] = rayId;
+        if (stats) stats->primitiveTests++;
+
+        // Any blocker ends the march, closest = 0 stops every level above
+        if (anyHit) {
+          if (primitives.OccludePrimitive(prim, ray)) {
+            closest = 0;
+            primIndex = prim;
+            return;
+          }
+          continue;
+        }
+        Real t = primitives.IntersectPrimitive(prim, ray);
+        if (t > BIAS && t < closest) {
+          closest = t;
+          primIndex = prim;
+        }
+      }
+    }
+
+    // Hits further away may still be beaten by something in a later cell
+    if (closest <= tExit || tExit >= tEnd) return;
+
+    const int axis = (tNext[0] < tNext[1])
+                         ? (tNext[0] < tNext[2] ? 0 : 2)
+                         : (tNext[1] < tNext[2] ? 1 : 2);
+    cell[axis] += step[axis];
+    if (cell[axis] == stop[axis]) return;
+    tEnter = tNext[axis];
+    tNext[axis] += tDelta[axis];
+  }
+}
+
+AABB Grid::GetBounds() const {
+  return levels.empty() ? AABB() : levels[0].bounds;
+}
+
+const char *Grid::GetName() const {
+  return (settings.gridLevels > 1) ? "Grid (2 level)" : "Grid";
+}
+
+size_t Grid::GetMemoryUsage() const {
+  size_t bytes = 0;
+  for (const auto &level : levels)
+    bytes += sizeof(Level) + level.cellStart.size() * sizeof(unsigned) +
+             level.cellPrims.size() * sizeof(unsigned) +
+             level.subgrid.size() * sizeof(int);
+  return bytes;
+}
@@ -0,0 +1,66 @@
+#pragma once
+#include <vector>
+#include "Accelerator.h"
+
+constexpr double GRID_DENSITY = 4;  // cells per primitive
+constexpr int GRID_MAX_RESOLUTION = 256;  // cells along one axis
+// Cells of a two level grid holding more primitives than this get a subgrid
+constexpr unsigned GRID_SUBGRID_THRESHOLD = 16;
+
+// Uniform grid, optionally two level, traversed with a 3D-DDA. Cheap to
+// build and hard to beat for dense, evenly distributed primitives. A
+// primitive overlapping several cells is still tested once per ray thanks
+// to per thread mailboxes
+class Grid : public Accelerator {
+ public:
+  Grid(const Settings &settings_ = Settings());
+  ~Grid();
+  // The id names the per thread mailboxes, copies would share it
+  Grid(const Grid &) = delete;
+  Grid &operator=(const Grid &) = delete;
+
+  void Build(const std::vector<AABB> &primBounds,
+             const PrimitiveIntersector &primitives);
+  // Grids are cheap to build, so refitting rebuilds the cells in place. The
+  // grid keeps its id and with it the mailboxes of every thread
+  bool Refit(const std::vector<AABB> &primBounds);
+
+  Real Intersect(const Ray &ray, const PrimitiveIntersector &primitives,
+                 unsigned &primIndex, TraversalStats *stats = nullptr) const;
+  bool Occluded(const Ray &ray, const PrimitiveIntersector &primitives,
+                TraversalStats *stats = nullptr) const;
+
+  AABB GetBounds() const;
+  const char *GetName() const;
+  size_t GetMemoryUsage() const;
+
+ private:
+  struct Level {
+    AABB bounds;
+    int resolution[3];
+    Vector3r cellSize, invCellSize;
+    std::vector<unsigned> cellStart;  // cell -> first entry of cellPrims
+    std::vector<unsigned> cellPrims;
+    std::vector<int> subgrid;  // cell -> level index, -1 if none (top only)
+  };
+
+  void BuildCells(const std::vector<AABB> &primBounds);
+  void BuildLevel(Level &level, const AABB &bounds,
+                  const std::vector<unsigned> &prims,
+                  const std::vector<AABB> &primBounds);
+  // Closest hit distance, or any hit's when anyHit is set, -1 on a miss
+  Real March(const Ray &ray, const PrimitiveIntersector &primitives,
+             const bool anyHit, unsigned &primIndex,
+             TraversalStats *stats) const;
+  // Marches the cells of one level between tStart and tEnd
+  void TraverseLevel(const Level &level, const Ray &ray, const Real tStart,
+                     const Real tEnd, const PrimitiveIntersector &primitives,
+                     const bool anyHit, Real &closest, unsigned &primIndex,
+                     std::vector<uint32_t> &mailbox, const uint32_t rayId,
+                     TraversalStats *stats) const;
+
+  Settings settings;
+  std::vector<Level> levels;
+  unsigned primCount = 0;
+  uint64_t id;  // identifies this grid's per thread mailboxes, kept on rebuild
+};
@@ -0,0 +1,392 @@
+#include "KdTree.h"
+#include <algorithm>
+#include <cmath>
+
+namespace {
+// Sweep events of one axis. At equal positions ends come first, then flat
+// primitives, then starts, which is the order the SAH sweep needs
+struct SplitEvent {
+  Real position;
+  enum TYPES { END = 0, PLANAR = 1, START = 2 } type;
+
+  bool operator<(const SplitEvent &other) const {
+    return position < other.position ||
+           (position == other.position && type < other.type);
+  }
+};
+
+struct SplitCandidate {
+  double cost = std::numeric_limits<double>::max();
+  int axis = -1;
+  Real position = 0;
+  bool planarLeft = true;  // side taking primitives lying in the plane
+};
+
+double SplitCost(const double leftProbability, const double rightProbability,
+                 const size_t leftCount, const size_t rightCount) {
+  double cost = KD_TRAVERSAL_COST + leftProbability * leftCount +
+                rightProbability * rightCount;
+  return (leftCount == 0 || rightCount == 0) ? cost * (1 - KD_EMPTY_BONUS)
+                                             : cost;
+}
+}  // namespace
+
+KdTree::KdTree(const Settings &settings_) : settings{settings_} {}
+
+void KdTree::Build(const std::vector<AABB> &primBounds,
+                   const PrimitiveIntersector &primitives) {
+  nodes.clear();
+  leaves.clear();
+  primIndices.clear();
+  bounds = AABB();
+  sahCost = 0;
+  nodeView = nodes;
+  leafView = leaves;
+  primView = primIndices;
+  if (primBounds.empty()) return;
+
+  std::vector<BuildReference> refs(primBounds.size());
+  for (unsigned i = 0; i < primBounds.size(); i++) {
+    refs[i] = {primBounds[i], i};
+    bounds.Expand(primBounds[i]);
+  }
+
+  // Usual depth limit, kd-trees duplicate references so memory has to be
+  // kept in check on top of the SAH termination
+  unsigned maxDepth = std::min<unsigned>(
+      KD_MAX_DEPTH, 8 + 1.3 * std::log2(double(primBounds.size())));
+  BuildRecursive(refs, bounds, 0, maxDepth, primitives);
+
+  unsigned ropes[6];
+  std::fill(ropes, ropes + 6, KD_NO_ROPE);
+  BuildRopes(0, bounds, ropes);
+
+  double rootArea = bounds.SurfaceArea();
+  sahCost = (rootArea > 0) ? sahCost / rootArea : primBounds.size();
+
+  nodeView = nodes;
+  leafView = leaves;
+  primView = primIndices;
+}
+
+void KdTree::MakeLeaf(const std::vector<BuildReference> &refs,
+                      const AABB &nodeBounds) {
+  KdTreeLeaf leaf;
+  leaf.bounds = nodeBounds;
+  leaf.offset = primIndices.size();
+  leaf.count = refs.size();
+  for (const auto &ref : refs) primIndices.emplace_back(ref.index);
+
+  nodes.push_back({0, 3, unsigned(leaves.size())});
+  leaves.emplace_back(leaf);
+  sahCost += nodeBounds.SurfaceArea() * refs.size();
+}
+
+void KdTree::BuildRecursive(std::vector<BuildReference> &refs,
+                            const AABB &nodeBounds, const unsigned depth,
+                            const unsigned maxDepth,
+                            const PrimitiveIntersector &primitives) {
+  double nodeArea = nodeBounds.SurfaceArea();
+  if (refs.size() <= 1 || depth >= maxDepth || nodeArea <= 0) {
+    MakeLeaf(refs, nodeBounds);
+    return;
+  }
+
+  // Exact SAH: sweep the sorted primitive boundaries of every axis
+  SplitCandidate best;
+  std::vector<SplitEvent> events;
+  events.reserve(refs.size() * 2);
+  for (int axis = 0; axis < 3; axis++) {
+    events.clear();
+    for (const auto &ref : refs) {
+      Real min = ref.bounds.bounds[0][axis], max = ref.bounds.bounds[1][axis];
+      if (min == max)
+        events.push_back({min, SplitEvent::PLANAR});
+      else {
+        events.push_back({min, SplitEvent::START});
+        events.push_back({max, SplitEvent::END});
+      }
+    }
+    std::sort(events.begin(), events.end());
+
+    const Real boxMin = nodeBounds.bounds[0][axis];
+    const Real boxMax = nodeBounds.bounds[1][axis];
+    size_t leftCount = 0, rightCount = refs.size();
+    for (size_t i = 0; i < events.size();) {
+      const Real position = events[i].position;
+      size_t ending = 0, planar = 0, starting = 0;
+      for (; i < events.size() && events[i].position == position &&
+             events[i].type == SplitEvent::END; i++)
+        ending++;
+      for (; i < events.size() && events[i].position == position &&
+             events[i].type == SplitEvent::PLANAR; i++)
+        planar++;
+      for (; i < events.size() && events[i].position == position &&
+             events[i].type == SplitEvent::START; i++)
+        starting++;
+
+      rightCount -= planar + ending;
+      if (position > boxMin && position < boxMax) {
+        AABB left = nodeBounds, right = nodeBounds;
+        left.bounds[1][axis] = right.bounds[0][axis] = position;
+        double leftProbability = left.SurfaceArea() / nodeArea;
+        double rightProbability = right.SurfaceArea() / nodeArea;
+
+        double planarLeftCost = SplitCost(leftProbability, rightProbability,
+                                          leftCount + planar, rightCount);
+        double planarRightCost = SplitCost(leftProbability, rightProbability,
+                                           leftCount, rightCount + planar);
+        double cost = std::min(planarLeftCost, planarRightCost);
+        if (cost < best.cost) {
+          best.cost = cost;
+          best.axis = axis;
+          best.position = position;
+          best.planarLeft = planarLeftCost <= planarRightCost;
+        }
+      }
+      leftCount += starting + planar;
+    }
+  }
+
+  if (best.axis < 0 || best.cost >= refs.size()) {
+    MakeLeaf(refs, nodeBounds);
+    return;
+  }
+
+  // Straddling references are clipped to both sides, parts that end up
+  // empty (the primitive only grazes the box) are dropped
+  const int axis = best.axis;
+  std::vector<BuildReference> leftRefs, rightRefs;
+  for (const auto &ref : refs) {
+    Real min = ref.bounds.bounds[0][axis], max = ref.bounds.bounds[1][axis];
+    if (min == best.position && max == best.position) {
+      (best.planarLeft ? leftRefs : rightRefs).emplace_back(ref);
+    } else if (max <= best.position) {
+      leftRefs.emplace_back(ref);
+    } else if (min >= best.position) {
+      rightRefs.emplace_back(ref);
+    } else {
+      BuildReference left{AABB(), ref.index}, right{AABB(), ref.index};
+      primitives.SplitPrimitive(ref.index, axis, best.position, left.bounds,
+                                right.bounds);
+      left.bounds.Clip(ref.bounds);
+      right.bounds.Clip(ref.bounds);
+      left.bounds.bounds[1][axis] =
+          std::min(left.bounds.bounds[1][axis], best.position);
+      right.bounds.bounds[0][axis] =
+          std::max(right.bounds.bounds[0][axis], best.position);
+      if (!left.bounds.IsEmpty()) leftRefs.emplace_back(left);
+      if (!right.bounds.IsEmpty()) rightRefs.emplace_back(right);
+    }
+  }
+  std::vector<BuildReference>().swap(refs);
+
+  AABB leftBounds = nodeBounds, rightBounds = nodeBounds;
+  leftBounds.bounds[1][axis] = rightBounds.bounds[0][axis] = best.position;
+
+  unsigned nodeIndex = nodes.size();
+  nodes.push_back({best.position, unsigned(axis), 0});
+  sahCost += nodeArea * KD_TRAVERSAL_COST;
+  BuildRecursive(leftRefs, leftBounds, depth + 1, maxDepth, primitives);
+  nodes[nodeIndex].child = nodes.size();
+  BuildRecursive(rightRefs, rightBounds, depth + 1, maxDepth, primitives);
+}
+
+void KdTree::BuildRopes(const unsigned node, const AABB &nodeBounds,
+                        unsigned ropes[6]) {
+  // Push every rope down the neighbouring subtree while only one of its
+  // children touches this node, so traversal has less to descend later
+  for (int face = 0; face < 6; face++) {
+    const int faceAxis = face / 2;
+    while (ropes[face] != KD_NO_ROPE && nodes[ropes[face]].axis != 3) {
+      const KdTreeNode &neighbour = nodes[ropes[face]];
+      const unsigned below = ropes[face] + 1, above = neighbour.child;
+      if (int(neighbour.axis) == faceAxis)
+        ropes[face] = (face & 1) ? below : above;
+      else if (neighbour.split <= nodeBounds.bounds[0][neighbour.axis])
+        ropes[face] = above;
+      else if (neighbour.split >= nodeBounds.bounds[1][neighbour.axis])
+        ropes[face] = below;
+      else
+        break;
+    }
+  }
+
+  const KdTreeNode &current = nodes[node];
+  if (current.axis == 3) {
+    std::copy(ropes, ropes + 6, leaves[current.child].ropes);
+    return;
+  }
+
+  const unsigned axis = current.axis;
+  AABB leftBounds = nodeBounds, rightBounds = nodeBounds;
+  leftBounds.bounds[1][axis] = rightBounds.bounds[0][axis] = current.split;
+
+  unsigned leftRopes[6], rightRopes[6];
+  std::copy(ropes, ropes + 6, leftRopes);
+  std::copy(ropes, ropes + 6, rightRopes);
+  leftRopes[axis * 2 + 1] = current.child;
+  rightRopes[axis * 2] = node + 1;
+  BuildRopes(node + 1, leftBounds, leftRopes);
+  BuildRopes(current.child, rightBounds, rightRopes);
+}
+
+Real KdTree::Intersect(const Ray &ray, const PrimitiveIntersector &primitives,
+                       unsigned &primIndex, TraversalStats *stats) const {
+  if (nodeView.empty()) return -1;
+
+  const Vector3r origin = ray.GetOrigin();
+  const Vector3r direction = ray.GetDirection();
+  Real tEntry;
+  if (!bounds.Intersect(origin, ray, ray.tMax, tEntry)) return -1;
+
+  // A ray crosses every leaf at most once, the bound only stops a corrupt
+  // cache file whose ropes lead back into the same leaves
+  Real closest = ray.tMax;
+  unsigned node = 0;
+  for (unsigned leaves = 0; leaves < leafView.size; leaves++) {
+    // Down to the leaf holding the entry point, points on a split plane go
+    // to the side the ray is heading to
+    const Vector3r entry = origin + direction * tEntry;
+    while (nodeView[node].axis != 3) {
+      if (stats) stats->nodeVisits++;
+      const KdTreeNode &current = nodeView[node];
+      const Real position = entry[current.axis];
+      bool above = position > current.split ||
+                   (position == current.split && !ray.sign[current.axis]);
+      node = above ? current.child : node + 1;
+    }
+    if (stats) stats->nodeVisits++;
+
+    const KdTreeLeaf &leaf = leafView[nodeView[node].child];
+    if (stats) stats->primitiveTests += leaf.count;
+    Real t = primitives.IntersectPrimitives(&primView[leaf.offset],
+                                            leaf.count, ray, closest,
+                                            primIndex);
+    if (t > 0) closest = t;
+
+    // Leave through the nearest far face, unless the closest hit so far
+    // comes first
+    Real tExit = closest;
+    int exitFace = -1;
+    for (uint8_t axis = 0; axis < 3; axis++) {
+      Real t = (leaf.bounds.bounds[1 - ray.sign[axis]][axis] - origin[axis]) *
+               ray.invDir[axis];
+      if (t < tExit) {
+        tExit = t;
+        exitFace = axis * 2 + 1 - ray.sign[axis];
+      }
+    }
+    if (exitFace < 0 || leaf.ropes[exitFace] == KD_NO_ROPE) break;
+
+    node = leaf.ropes[exitFace];
+    tEntry = std::max(tEntry, tExit);
+  }
+
+  return (closest < ray.tMax) ? closest : -1;
+}
+
+bool KdTree::Occluded(const Ray &ray, const PrimitiveIntersector &primitives,
+                      TraversalStats *stats) const {
+  if (nodeView.empty()) return false;
+
+  const Vector3r origin = ray.GetOrigin();
+  const Vector3r direction = ray.GetDirection();
+  Real tEntry;
+  if (!bounds.Intersect(origin, ray, ray.tMax, tEntry)) return false;
+
+  // Same walk as Intersect, but any blocker before tMax ends it, even one
+  // lying beyond the current leaf
+  unsigned node = 0;
+  for (unsigned leaves = 0; leaves < leafView.size; leaves++) {
+    const Vector3r entry = origin + direction * tEntry;
+    while (nodeView[node].axis != 3) {
+      if (stats) stats->nodeVisits++;
+      const KdTreeNode &current = nodeView[node];
+      const Real position = entry[current.axis];
+      bool above = position > current.split ||
+                   (position == current.split && !ray.sign[current.axis]);
+      node = above ? current.child : node + 1;
+    }
+    if (stats) stats->nodeVisits++;
+
+    const KdTreeLeaf &leaf = leafView[nodeView[node].child];
+    if (stats) stats->primitiveTests += leaf.count;
+    if (primitives.OccludePrimitives(&primView[leaf.offset], leaf.count, ray))
+      return true;
+
+    Real tExit = ray.tMax;
+    int exitFace = -1;
+    for (uint8_t axis = 0; axis < 3; axis++) {
+      Real t = (leaf.bounds.bounds[1 - ray.sign[axis]][axis] - origin[axis]) *
+               ray.invDir[axis];
+      if (t < tExit) {
+        tExit = t;
+        exitFace = axis * 2 + 1 - ray.sign[axis];
+      }
+    }
+    if (exitFace < 0 || leaf.ropes[exitFace] == KD_NO_ROPE) return false;
+
+    node = leaf.ropes[exitFace];
+    tEntry = std::max(tEntry, tExit);
+  }
+  return false;
+}
+
+AABB KdTree::GetBounds() const { return bounds; }
+
+const char *KdTree::GetName() const { return "kd-tree"; }
+
+size_t KdTree::GetMemoryUsage() const {
+  return nodeView.size * sizeof(KdTreeNode) +
+         leafView.size * sizeof(KdTreeLeaf) + primView.size * sizeof(unsigned);
+}
+
+double KdTree::GetSAHCost() const { return sahCost; }
+
+std::vector<DataBlock> KdTree::GetArrays() const {
+  return {nodeView.ToBlock(),
+          leafView.ToBlock(),
+          primView.ToBlock(),
+          {&bounds, sizeof(bounds)},
+          {&sahCost, sizeof(sahCost)}};
+}
+
+bool KdTree::SetArrays(const std::vector<DataBlock> &arrays,
+                       const unsigned primCount) {
+  if (arrays.size() != 5 || arrays[3].size != sizeof(bounds) ||
+      arrays[4].size != sizeof(sahCost) || !nodeView.FromBlock(arrays[0]) ||
+      !leafView.FromBlock(arrays[1]) || !primView.FromBlock(arrays[2]) ||
+      !IndicesBelow(primView, primCount))
+    return false;
+
+  // Descending only moves to later nodes, so it ends at a leaf, and every
+  // index traversal follows stays inside the arrays. Ropes can point back
+  // to any node, traversal bounds the leaves it walks instead
+  for (unsigned i = 0; i < nodeView.size; i++) {
+    const KdTreeNode &node = nodeView[i];
+    if (node.axis == 3) {
+      if (node.child >= leafView.size) return false;
+    } else if (node.axis > 3 || i + 1 >= nodeView.size || node.child <= i ||
+               node.child >= nodeView.size) {
+      return false;
+    }
+  }
+  for (const KdTreeLeaf &leaf : leafView) {
+    if (!RangeWithin(leaf.offset, leaf.count, primView.size)) return false;
+    for (unsigned rope : leaf.ropes)
+      if (rope != KD_NO_ROPE && rope >= nodeView.size) return false;
+  }
+
+  nodes.clear();
+  leaves.clear();
+  primIndices.clear();
+  bounds = *static_cast<const AABB *>(arrays[3].data);
+  sahCost = *static_cast<const double *>(arrays[4].data);
+  return true;
+}
+
+std::vector<unsigned> KdTree::ReorderPrimitives(const unsigned primCount) {
+  if (primIndices.empty()) return {};
+  return RenumberPrimitives(primIndices, primCount);
+}
@@ -0,0 +1,80 @@
+#pragma once
+#include <vector>
+#include "Accelerator.h"
+
+// Kd nodes are cheaper to step through than BVH nodes, so the SAH prefers
+// deeper trees than it would with BVH_TRAVERSAL_COST
+constexpr double KD_TRAVERSAL_COST = 0.75;  // relative to one primitive test
+constexpr double KD_EMPTY_BONUS = 0.2;  // cost discount for cutting off space
+constexpr unsigned KD_MAX_DEPTH = 64;
+constexpr unsigned KD_NO_ROPE = ~0u;  // leaf face on the tree bounds
+
+// Flattened (depth first) kd-tree node. The child below the split plane is
+// always the next node, so only the one above it is stored
+struct KdTreeNode {
+  Real split;      // split plane position along axis
+  unsigned axis;   // split axis, 3 for leaves
+  unsigned child;  // child above the plane (interior) or leaf index
+};
+
+// Leaves keep their box and a rope per face, pointing at the smallest node
+// holding everything on the other side of that face
+struct KdTreeLeaf {
+  AABB bounds;
+  unsigned offset, count;  // primitives in primIndices
+  unsigned ropes[6];       // [axis * 2 + (0: min face, 1: max face)]
+};
+
+// SAH kd-tree with perfect splits (primitives are clipped to the node boxes
+// through PrimitiveIntersector::SplitPrimitive). Traversal is stackless:
+// the ray walks from leaf to leaf following the ropes of the exit faces.
+// Ignores the builder setting
+class KdTree : public Accelerator {
+ public:
+  KdTree(const Settings &settings_ = Settings());
+
+  void Build(const std::vector<AABB> &primBounds,
+             const PrimitiveIntersector &primitives);
+
+  Real Intersect(const Ray &ray, const PrimitiveIntersector &primitives,
+                 unsigned &primIndex, TraversalStats *stats = nullptr) const;
+  bool Occluded(const Ray &ray, const PrimitiveIntersector &primitives,
+                TraversalStats *stats = nullptr) const;
+
+  AABB GetBounds() const;
+  const char *GetName() const;
+  size_t GetMemoryUsage() const;
+  double GetSAHCost() const;
+
+  std::vector<DataBlock> GetArrays() const;
+  bool SetArrays(const std::vector<DataBlock> &arrays,
+                 const unsigned primCount);
+  std::vector<unsigned> ReorderPrimitives(const unsigned primCount);
+
+  // Filled by Build, empty when running on a cache file
+  std::vector<KdTreeNode> nodes;
+  std::vector<KdTreeLeaf> leaves;
+  std::vector<unsigned> primIndices;
+
+ private:
+  struct BuildReference {
+    AABB bounds;
+    unsigned index;
+  };
+
+  void BuildRecursive(std::vector<BuildReference> &refs,
+                      const AABB &nodeBounds, const unsigned depth,
+                      const unsigned maxDepth,
+                      const PrimitiveIntersector &primitives);
+  void MakeLeaf(const std::vector<BuildReference> &refs,
+                const AABB &nodeBounds);
+  void BuildRopes(const unsigned node, const AABB &nodeBounds,
+                  unsigned ropes[6]);
+
+  Settings settings;
+  AABB bounds;
+  double sahCost = 0;
+  ArrayView<KdTreeNode> nodeView;
+  ArrayView<KdTreeLeaf> leafView;
+  ArrayView<unsigned> primView;
+};
@@ -0,0 +1,247 @@
+#include "BVH.h"
+#include "Parallel.h"
+
+// Linear BVH (Lauterbach et al. 2009): primitives are sorted along a Morton
+// curve through their centroids and the tree falls out of the sorted codes by
+// splitting ranges at their highest differing bit. Everything but the few
+// top levels runs on all hardware threads
+
+namespace {
+constexpr int MORTON_BITS = 21;  // per axis, 63 bit codes
+constexpr unsigned RADIX_BITS = 8;
+constexpr unsigned RADIX_BUCKETS = 1 << RADIX_BITS;
+constexpr unsigned LBVH_TASKS_PER_THREAD = 4;
+
+// Spreads the lower 21 bits of v so there are two zero bits between them
+inline uint64_t ExpandBits(uint64_t v) {
+  v &= 0x1fffff;
+  v = (v | v << 32) & 0x1f00000000ffff;
+  v = (v | v << 16) & 0x1f0000ff0000ff;
+  v = (v | v << 8) & 0x100f00f00f00f00f;
+  v = (v | v << 4) & 0x10c30c30c30c30c3;
+  v = (v | v << 2) & 0x1249249249249249;
+  return v;
+}
+
+// Parallel least significant digit radix sort of the code / index pairs
+void RadixSort(std::vector<uint64_t> &codes, std::vector<unsigned> &indices,
+               const unsigned nThreads) {
+  const size_t n = codes.size();
+  std::vector<uint64_t> sortedCodes(n);
+  std::vector<unsigned> sortedIndices(n);
+  std::vector<size_t> offsets(nThreads * RADIX_BUCKETS);
+
+  for (int shift = 0; shift < 3 * MORTON_BITS; shift += RADIX_BITS) {
+    std::fill(offsets.begin(), offsets.end(), 0);
+    ParallelFor(n, nThreads, [&](size_t begin, size_t end, unsigned thread) {
+      size_t *histogram = &offsets[thread * RADIX_BUCKETS];
+      for (size_t i = begin; i < end; i++)
+        histogram[(codes[i] >> shift) & (RADIX_BUCKETS - 1)]++;
+    });
+
+    // Each thread writes its part of a bucket after the earlier threads, so
+    // the sort stays stable
+    size_t sum = 0;
+    for (unsigned bucket = 0; bucket < RADIX_BUCKETS; bucket++) {
+      for (unsigned thread = 0; thread < nThreads; thread++) {
+        size_t count = offsets[thread * RADIX_BUCKETS + bucket];
+        offsets[thread * RADIX_BUCKETS + bucket] = sum;
+        sum += count;
+      }
+    }
+
+    ParallelFor(n, nThreads, [&](size_t begin, size_t end, unsigned thread) {
+      size_t *offset = &offsets[thread * RADIX_BUCKETS];
+      for (size_t i = begin; i < end; i++) {
+        size_t &dst = offset[(codes[i] >> shift) & (RADIX_BUCKETS - 1)];
+        sortedCodes[dst] = codes[i];
+        sortedIndices[dst] = indices[i];
+        dst++;
+      }
+    });
+    codes.swap(sortedCodes);
+    indices.swap(sortedIndices);
+  }
+}
+
+// Range of sorted primitives, bit is the highest bit left to split on
+struct LBVHRange {
+  unsigned start, end;
+  int bit;
+  unsigned depth;
+};
+
+struct LBVHBuilder {
+  const std::vector<AABB> &primBounds;
+  const std::vector<uint64_t> &codes;
+  const std::vector<unsigned> &primIndices;
+
+  bool IsLeaf(const LBVHRange &range) const {
+    return range.end - range.start <= BVH_MAX_LEAF_SIZE ||
+           range.depth >= BVH_MAX_DEPTH;
+  }
+
+  // Splits at the first code with the highest differing bit set. Ranges of
+  // identical codes are split in the middle
+  unsigned Split(const LBVHRange &range, LBVHRange &left,
+                 LBVHRange &right, unsigned &axis) const {
+    int bit = range.bit;
+    const uint64_t first = codes[range.start], last = codes[range.end - 1];
+    while (bit >= 0 && ((first >> bit) & 1) == ((last >> bit) & 1)) bit--;
+
+    unsigned split;
+    if (bit < 0) {
+      split = (range.start + range.end) / 2;
+      axis = 0;
+    } else {
+      const uint64_t mask = uint64_t(1) << bit;
+      split = std::partition_point(
+                  &codes[range.start], &codes[0] + range.end,
+                  [mask](uint64_t code) { return !(code & mask); }) -
+              &codes[0];
+      axis = 2 - bit % 3;  // x occupies bits 3k + 2, z bits 3k
+    }
+    left = {range.start, split, bit - 1, range.depth + 1};
+    right = {split, range.end, bit - 1, range.depth + 1};
+    return split;
+  }
+
+  // Depth first emission into out, returns the index of the subtree root
+  unsigned Emit(const LBVHRange &range, std::vector<BVHNode> &out,
+                unsigned &maxDepth) const {
+    maxDepth = std::max(maxDepth, range.depth);
+    unsigned nodeIndex = out.size();
+    out.emplace_back();
+
+    if (IsLeaf(range)) {
+      AABB bounds;
+      for (unsigned i = range.start; i < range.end; i++)
+        bounds.Expand(primBounds[primIndices[i]]);
+      out[nodeIndex].bounds = bounds;
+      out[nodeIndex].offset = range.start;
+      out[nodeIndex].count = range.end - range.start;
+      out[nodeIndex].axis = 0;
+      return nodeIndex;
+    }
+
+    LBVHRange left, right;
+    unsigned axis;
+    Split(range, left, right, axis);
+    Emit(left, out, maxDepth);
+    unsigned rightIndex = Emit(right, out, maxDepth);
+
+    AABB bounds = out[nodeIndex + 1].bounds;
+    bounds.Expand(out[rightIndex].bounds);
+    out[nodeIndex].bounds = bounds;
+    out[nodeIndex].offset = rightIndex;
+    out[nodeIndex].count = 0;
+    out[nodeIndex].axis = axis;
+    return nodeIndex;
+  }
+
+  // Splits the top of the tree until there are enough subtrees to keep all
+  // threads busy
+  void CollectTasks(const LBVHRange &range, const unsigned levels,
+                    std::vector<LBVHRange> &tasks) const {
+    if (!levels || IsLeaf(range)) {
+      tasks.emplace_back(range);
+      return;
+    }
+    LBVHRange left, right;
+    unsigned axis;
+    Split(range, left, right, axis);
+    CollectTasks(left, levels - 1, tasks);
+    CollectTasks(right, levels - 1, tasks);
+  }
+
+  // Repeats the CollectTasks splits, emitting the top nodes and copying the
+  // prebuilt subtrees in depth first order
+  unsigned EmitTop(const LBVHRange &range, const unsigned levels,
+                   std::vector<std::vector<BVHNode>> &subtrees,
+                   unsigned &nextTask, std::vector<BVHNode> &out) const {
+    unsigned nodeIndex = out.size();
+    if (!levels || IsLeaf(range)) {
+      for (BVHNode node : subtrees[nextTask]) {
+        if (!node.count) node.offset += nodeIndex;
+        out.emplace_back(node);
+      }
+      std::vector<BVHNode>().swap(subtrees[nextTask++]);
+      return nodeIndex;
+    }
+
+    out.emplace_back();
+    LBVHRange left, right;
+    unsigned axis;
+    Split(range, left, right, axis);
+    EmitTop(left, levels - 1, subtrees, nextTask, out);
+    unsigned rightIndex = EmitTop(right, levels - 1, subtrees, nextTask, out);
+
+    AABB bounds = out[nodeIndex + 1].bounds;
+    bounds.Expand(out[rightIndex].bounds);
+    out[nodeIndex].bounds = bounds;
+    out[nodeIndex].offset = rightIndex;
+    out[nodeIndex].count = 0;
+    out[nodeIndex].axis = axis;
+    return nodeIndex;
+  }
+};
+}  // namespace
+
+void BVH::BuildLBVH(const std::vector<AABB> &primBounds) {
+  const unsigned nThreads = ThreadCount();
+  const size_t n = primBounds.size();
+
+  // Quantize centroids to a 2^21 grid over the centroid bounds
+  std::vector<AABB> threadBounds(nThreads);
+  ParallelFor(n, nThreads, [&](size_t begin, size_t end, unsigned thread) {
+    for (size_t i = begin; i < end; i++)
+      threadBounds[thread].Expand(primBounds[i].Centroid());
+  });
+  AABB centroidBounds;
+  for (const auto &bounds : threadBounds) centroidBounds.Expand(bounds);
+
+  Vector3r scale;
+  for (uint8_t axis = 0; axis < 3; axis++) {
+    double extent =
+        centroidBounds.bounds[1][axis] - centroidBounds.bounds[0][axis];
+    scale[axis] = (extent > 0) ? ((1 << MORTON_BITS) - 1) / extent : 0;
+  }
+
+  std::vector<uint64_t> codes(n);
+  primIndices.resize(n);
+  ParallelFor(n, nThreads, [&](size_t begin, size_t end, unsigned) {
+    for (size_t i = begin; i < end; i++) {
+      Vector3r p =
+          (primBounds[i].Centroid() - centroidBounds.bounds[0]) * scale;
+      codes[i] = ExpandBits(uint64_t(p.x)) << 2 |
+                 ExpandBits(uint64_t(p.y)) << 1 | ExpandBits(uint64_t(p.z));
+      primIndices[i] = i;
+    }
+  });
+  RadixSort(codes, primIndices, nThreads);
+
+  // Subtrees below the task level are built independently, then stitched
+  // under the top levels
+  LBVHBuilder builder{primBounds, codes, primIndices};
+  const LBVHRange root = {0, unsigned(n), 3 * MORTON_BITS - 1, 1};
+  unsigned levels = 0;
+  while ((1u << levels) < nThreads * LBVH_TASKS_PER_THREAD) levels++;
+  if (nThreads == 1) levels = 0;
+
+  std::vector<LBVHRange> tasks;
+  builder.CollectTasks(root, levels, tasks);
+
+  std::vector<std::vector<BVHNode>> subtrees(tasks.size());
+  std::vector<unsigned> subtreeDepths(tasks.size(), 0);
+  ParallelFor(tasks.size(), nThreads, [&](size_t begin, size_t end, unsigned) {
+    for (size_t i = begin; i < end; i++) {
+      subtrees[i].reserve(2 * (tasks[i].end - tasks[i].start));
+      builder.Emit(tasks[i], subtrees[i], subtreeDepths[i]);
+    }
+  });
+  for (unsigned taskDepth : subtreeDepths) depth = std::max(depth, taskDepth);
+
+  nodes.reserve(2 * n);
+  unsigned nextTask = 0;
+  builder.EmitTop(root, levels, subtrees, nextTask, nodes);
+}
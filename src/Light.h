@@ -9,18 +9,18 @@ struct Light {
 
   Light();
 
-  Light(Vector3d position_, Color color_, double intensity_, enum LIGHT_TYPES);
+  Light(Vector3r position_, Color color_, double intensity_, enum LIGHT_TYPES);
 
-  void SetPosition(const Vector3d &position_);
+  void SetPosition(const Vector3r &position_);
   void SetColor(const Color &color_);
   void SetIntensity(const double intensity_);
   Color GetColor();
-  Vector3d GetPosition();
+  Vector3r GetPosition();
   double GetIntensity();
   unsigned GetLightType();
 
  private:
   Color color;
-  Vector3d position;
+  Vector3r position;
   double intensity;
 };
@@ -0,0 +1,87 @@
+#include "LightTree.h"
+#include <algorithm>
+
+void LightTree::Build(const std::vector<std::shared_ptr<Light>> &lights) {
+  nodes.clear();
+  if (lights.empty()) return;
+
+  std::vector<Vector3r> positions;
+  std::vector<double> intensities;
+  std::vector<unsigned> indices(lights.size());
+  for (unsigned i = 0; i < lights.size(); i++) {
+    positions.emplace_back(lights[i]->GetPosition());
+    intensities.emplace_back(lights[i]->GetIntensity());
+    indices[i] = i;
+  }
+
+  nodes.reserve(2 * lights.size() - 1);
+  nodes.emplace_back();
+  BuildNode(0, indices.begin(), indices.end(), positions, intensities);
+}
+
+void LightTree::BuildNode(const unsigned index,
+                          std::vector<unsigned>::iterator begin,
+                          std::vector<unsigned>::iterator end,
+                          const std::vector<Vector3r> &positions,
+                          const std::vector<double> &intensities) {
+  Node node;
+  node.intensity = 0;
+  for (auto light = begin; light != end; light++) {
+    node.bounds.Expand(positions[*light]);
+    node.intensity += intensities[*light];
+  }
+
+  if (end - begin == 1) {
+    node.offset = *begin;
+    node.leaf = true;
+    nodes[index] = node;
+    return;
+  }
+
+  // Median split along the longest axis, both children are stored next to
+  // each other so a node only needs the index of the first one
+  const int axis = node.bounds.MaxExtent();
+  auto middle = begin + (end - begin) / 2;
+  std::nth_element(begin, middle, end, [&](unsigned a, unsigned b) {
+    return positions[a][axis] < positions[b][axis];
+  });
+  node.offset = nodes.size();
+  node.leaf = false;
+  nodes[index] = node;
+  nodes.emplace_back();
+  nodes.emplace_back();
+  BuildNode(node.offset, begin, middle, positions, intensities);
+  BuildNode(node.offset + 1, middle, end, positions, intensities);
+}
+
+double LightTree::Importance(const Node &node, const Vector3r &point) const {
+  Vector3r diagonal = node.bounds.GetMax() - node.bounds.GetMin();
+  Vector3r toCenter = node.bounds.Centroid() - point;
+  double distance = std::max(toCenter.Magnitude(),
+                             std::max(diagonal.Magnitude() / 2, BIAS));
+  return node.intensity / distance;
+}
+
+unsigned LightTree::Sample(const Vector3r &point, double u,
+                           double &pdf) const {
+  unsigned index = 0;
+  pdf = 1;
+  while (!nodes[index].leaf) {
+    const unsigned left = nodes[index].offset;
+    double wLeft = Importance(nodes[left], point);
+    double wRight = Importance(nodes[left + 1], point);
+    double pLeft = (wLeft + wRight > 0) ? wLeft / (wLeft + wRight) : 0.5;
+
+    // u is rescaled so it stays uniform for the choices further down
+    if (u < pLeft) {
+      u /= pLeft;
+      pdf *= pLeft;
+      index = left;
+    } else {
+      u = (u - pLeft) / (1 - pLeft);
+      pdf *= 1 - pLeft;
+      index = left + 1;
+    }
+  }
+  return nodes[index].offset;
+}
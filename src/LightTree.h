@@ -0,0 +1,43 @@
+#pragma once
+#include <memory>
+#include <vector>
+#include "AABB.h"
+#include "Light.h"
+
+// Shading points with more lights than this pick that many from the light
+// tree instead of looping over all of them
+constexpr unsigned LIGHT_SAMPLES = 8;
+
+// Binary tree over the point lights of a scene, used to pick lights at
+// random in proportion to how much they can light a point. A sample costs
+// O(log lights), so scenes with thousands of small lights shade in time
+// that barely depends on their number
+class LightTree {
+ public:
+  void Build(const std::vector<std::shared_ptr<Light>> &lights);
+
+  // Picks a light for the point, u uniform in [0, 1). pdf is the probability
+  // the light had of being picked
+  unsigned Sample(const Vector3r &point, double u, double &pdf) const;
+
+  bool empty() const { return nodes.empty(); }
+
+ private:
+  struct Node {
+    AABB bounds;
+    double intensity;  // of all the lights below
+    unsigned offset;   // first child, or the light of a leaf
+    bool leaf;
+  };
+
+  // Fills node "index" with the lights in [begin, end)
+  void BuildNode(const unsigned index, std::vector<unsigned>::iterator begin,
+                 std::vector<unsigned>::iterator end,
+                 const std::vector<Vector3r> &positions,
+                 const std::vector<double> &intensities);
+  // Light can fall off no faster than 1 / distance (see Trace), measured
+  // to the node's center but never closer than half its diagonal
+  double Importance(const Node &node, const Vector3r &point) const;
+
+  std::vector<Node> nodes;
+};
@@ -20,16 +20,16 @@ class Material : public Color {
   void SetRefraction(const double &refractive_) { refractive = refractive_; }
   void SetSpecial(const double &special_) { special = special_; }
 
-  Color GetColor() { return color; }
-  double GetAmbient() { return ambient; }
-  double GetSpecular() { return 1 - diffusive; }
-  double GetDiffuse() { return diffusive; }
-  double GetReflection() { return reflective; }
+  Color GetColor() const { return color; }
+  double GetAmbient() const { return ambient; }
+  double GetSpecular() const { return 1 - diffusive; }
+  double GetDiffuse() const { return diffusive; }
+  double GetReflection() const { return reflective; }
   double GetRefraction() const { return this->refractive; }
-  double GetSpecial() { return special; }
+  double GetSpecial() const { return special; }
 
   void SetMaterial(const Material &material_) { *this = material_; }
-  Material GetMaterial() { return *this; }
+  Material GetMaterial() const { return *this; }
 
  private:
   Color color;
@@ -52,8 +52,9 @@ class Matrix44 {
       }
     }
   }
-  // void MultVecMatrix(const Vector3d &src, Vector3d &dst) const;
-  void MultVecMatrix(const Vector3d &src, Vector3d &dst) const {
+  // Vectors of any precision, the camera keeps a float matrix
+  template <typename S>
+  void MultVecMatrix(const Vector3<S> &src, Vector3<S> &dst) const {
     double a, b, c, w;
 
     a = src[0] * x[0][0] + src[1] * x[1][0] + src[2] * x[2][0] + x[3][0];
@@ -146,7 +147,8 @@ class Matrix44 {
     return s;
   }
 
-  void MultDirMatrix(const Vector3d &src, Vector3d &dst) const {
+  template <typename S>
+  void MultDirMatrix(const Vector3<S> &src, Vector3<S> &dst) const {
     dst.x = src.x * x[0][0] + src.y * x[1][0] + src.z * x[2][0];
     dst.y = src.x * x[0][1] + src.y * x[1][1] + src.z * x[2][1];
     dst.z = src.x * x[0][2] + src.y * x[1][2] + src.z * x[2][2];
@@ -190,3 +192,4 @@ class Matrix44 {
 
 typedef Matrix44<float> Matrix44f;
 typedef Matrix44<double> Matrix44d;
+typedef Matrix44<Real> Matrix44r;
@@ -0,0 +1,168 @@
+#include "MeshCache.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include "BVH.h"
+#include "KdTree.h"
+
+namespace {
+constexpr char CACHE_MAGIC[8] = "TRCYMSH";
+constexpr size_t CACHE_ALIGNMENT = 64;  // of every block in the file
+
+// Followed by blockCount uint64_t block sizes, then the aligned blocks
+struct CacheHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t blockCount;
+};
+
+size_t AlignUp(const size_t offset) {
+  return (offset + CACHE_ALIGNMENT - 1) / CACHE_ALIGNMENT * CACHE_ALIGNMENT;
+}
+
+// Word at a time multiply / xor hash, several GB/s so hashing a big OBJ
+// costs far less than parsing it
+uint64_t Hash(const char *data, const size_t size, uint64_t hash) {
+  constexpr uint64_t multiplier = 0xff51afd7ed558ccdull;
+  hash ^= size * multiplier;
+  size_t i = 0;
+  for (; i + 8 <= size; i += 8) {
+    uint64_t word;
+    memcpy(&word, data + i, 8);
+    hash = (hash ^ word) * multiplier;
+    hash ^= hash >> 32;
+  }
+  for (; i < size; i++) hash = (hash ^ uint8_t(data[i])) * multiplier;
+  return hash ^ (hash >> 29);
+}
+}  // namespace
+
+MappedFile::MappedFile(const std::string &path) {
+  int file = open(path.c_str(), O_RDONLY);
+  if (file < 0) return;
+
+  struct stat info;
+  if (fstat(file, &info) == 0 && info.st_size > 0) {
+    void *mapping =
+        mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+    if (mapping != MAP_FAILED) {
+      data = static_cast<const char *>(mapping);
+      size = info.st_size;
+    }
+  }
+  close(file);
+}
+
+MappedFile::~MappedFile() {
+  if (data) munmap(const_cast<char *>(data), size);
+}
+
+bool HashFile(const char *path, uint64_t &hash) {
+  MappedFile file(path);
+  if (!file.IsOpen()) return false;
+  hash = Hash(file.GetData(), file.GetSize(), 0);
+  return true;
+}
+
+std::string GetMeshCachePath(const uint64_t objHash,
+                             const Accelerator::Settings &settings) {
+  // Every setting that changes the built structure goes into the name, and
+  // so do the precision its bounds and splits are stored in and the build
+  // constants of the BVHs and k-d tree
+  const uint64_t key[] = {MESH_CACHE_VERSION,
+                          sizeof(Real),
+                          uint64_t(settings.type),
+                          uint64_t(settings.builder),
+                          uint64_t(settings.maxDuplication * 1e6),
+                          settings.gridLevels,
+                          BVH_SAH_BINS,
+                          BVH_MAX_LEAF_SIZE,
+                          BVH_MAX_DEPTH,
+                          uint64_t(BVH_TRAVERSAL_COST * 1e6),
+                          SBVH_SPATIAL_BINS,
+                          uint64_t(SBVH_OVERLAP_THRESHOLD * 1e12),
+                          uint64_t(KD_TRAVERSAL_COST * 1e6),
+                          uint64_t(KD_EMPTY_BONUS * 1e6),
+                          KD_MAX_DEPTH};
+  uint64_t settingsHash =
+      Hash(reinterpret_cast<const char *>(key), sizeof(key), objHash);
+
+  char name[64];
+  snprintf(name, sizeof(name), "/%016llx-%016llx.mesh",
+           (unsigned long long)objHash, (unsigned long long)settingsHash);
+  return MESH_CACHE_DIRECTORY + std::string(name);
+}
+
+bool WriteMeshCache(const std::string &path,
+                    const std::vector<DataBlock> &blocks) {
+  mkdir(MESH_CACHE_DIRECTORY, 0755);
+
+  // Written under a unique temporary name and renamed, so threads and
+  // processes loading the same mesh never map a half written file
+  std::string temporary = path + ".XXXXXX";
+  int descriptor = mkstemp(&temporary[0]);
+  if (descriptor < 0) return false;
+  // mkstemp creates it readable by the owner only
+  fchmod(descriptor, 0644);
+  close(descriptor);
+  std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+  if (!file) {
+    remove(temporary.c_str());
+    return false;
+  }
+
+  CacheHeader header;
+  memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+  header.version = MESH_CACHE_VERSION;
+  header.blockCount = blocks.size();
+  file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  for (const auto &block : blocks) {
+    uint64_t size = block.size;
+    file.write(reinterpret_cast<const char *>(&size), sizeof(size));
+  }
+
+  const char padding[CACHE_ALIGNMENT] = {};
+  size_t offset = sizeof(header) + blocks.size() * sizeof(uint64_t);
+  for (const auto &block : blocks) {
+    file.write(padding, AlignUp(offset) - offset);
+    file.write(static_cast<const char *>(block.data), block.size);
+    offset = AlignUp(offset) + block.size;
+  }
+  file.close();
+
+  if (!file || rename(temporary.c_str(), path.c_str()) != 0) {
+    remove(temporary.c_str());
+    return false;
+  }
+  return true;
+}
+
+std::unique_ptr<MappedFile> ReadMeshCache(const std::string &path,
+                                          std::vector<DataBlock> &blocks) {
+  auto file = std::make_unique<MappedFile>(path);
+  if (!file->IsOpen() || file->GetSize() < sizeof(CacheHeader)) return nullptr;
+
+  const CacheHeader *header =
+      reinterpret_cast<const CacheHeader *>(file->GetData());
+  if (memcmp(header->magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) ||
+      header->version != MESH_CACHE_VERSION)
+    return nullptr;
+
+  size_t offset = sizeof(CacheHeader) + header->blockCount * sizeof(uint64_t);
+  if (offset > file->GetSize()) return nullptr;
+  const uint64_t *blockSizes = reinterpret_cast<const uint64_t *>(header + 1);
+
+  blocks.clear();
+  for (uint32_t i = 0; i < header->blockCount; i++) {
+    offset = AlignUp(offset);
+    if (offset > file->GetSize() || blockSizes[i] > file->GetSize() - offset)
+      return nullptr;
+    blocks.push_back({file->GetData() + offset, blockSizes[i]});
+    offset += blockSizes[i];
+  }
+  return file;
+}
@@ -0,0 +1,46 @@
+#pragma once
+#include <memory>
+#include <string>
+#include <vector>
+#include "Accelerator.h"
+
+// Built meshes are written here and mapped back on later runs, "" disables
+// the cache
+constexpr const char *MESH_CACHE_DIRECTORY = "cache";
+// Bump whenever the layout of anything written to the cache changes, or a
+// build constant that isn't part of the cache key (see GetMeshCachePath,
+// e.g. MORTON_BITS of the LBVH builder) does
+constexpr uint32_t MESH_CACHE_VERSION = 2;
+
+// Read only memory mapping of a whole file
+class MappedFile {
+ public:
+  explicit MappedFile(const std::string &path);
+  ~MappedFile();
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  bool IsOpen() const { return data != nullptr; }
+  const char *GetData() const { return data; }
+  size_t GetSize() const { return size; }
+
+ private:
+  const char *data = nullptr;
+  size_t size = 0;
+};
+
+// 64-bit hash of the content of a file, false if it can't be read
+bool HashFile(const char *path, uint64_t &hash);
+
+// Cache file of an OBJ (by content hash) built with the given settings
+std::string GetMeshCachePath(const uint64_t objHash,
+                             const Accelerator::Settings &settings);
+
+// Writes the blocks to a new cache file, replacing any previous one
+bool WriteMeshCache(const std::string &path,
+                    const std::vector<DataBlock> &blocks);
+
+// Maps a cache file and points the blocks into it, nullptr if it is missing
+// or doesn't look right. The mapping must outlive every use of the blocks
+std::unique_ptr<MappedFile> ReadMeshCache(const std::string &path,
+                                          std::vector<DataBlock> &blocks);
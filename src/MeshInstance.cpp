@@ -0,0 +1,56 @@
+#include "MeshInstance.h"
+
+MeshInstance::MeshInstance(std::shared_ptr<const TriangleMesh> mesh_,
+                           const Matrix44r &objectToWorld_)
+    : mesh{mesh_},
+      objectToWorld{objectToWorld_},
+      worldToObject{objectToWorld.Inverse()},
+      normalToWorld{worldToObject.Transpose()} {}
+
+Ray MeshInstance::ToObjectSpace(const Ray &ray) const {
+  // The direction is left unnormalized so distances along the object space
+  // ray are the same as along the world space one
+  Vector3r origin, direction;
+  worldToObject.MultVecMatrix(ray.GetOrigin(), origin);
+  worldToObject.MultDirMatrix(ray.GetDirection(), direction);
+  Ray objectRay(origin, direction);
+  objectRay.tMin = ray.tMin;
+  objectRay.tMax = ray.tMax;
+  return objectRay;
+}
+
+bool MeshInstance::Intersect(const Ray &ray, Hit &hit) const {
+  if (!mesh->Intersect(ToObjectSpace(ray), hit)) return false;
+
+  Vector3r objectNormal = hit.normal;
+  normalToWorld.MultDirMatrix(objectNormal, hit.normal);
+  hit.normal.Normalize();
+  objectNormal = hit.geometricNormal;
+  normalToWorld.MultDirMatrix(objectNormal, hit.geometricNormal);
+  hit.geometricNormal.Normalize();
+  return true;
+}
+
+bool MeshInstance::Occluded(const Ray &ray, const Real tMax) const {
+  Ray objectRay = ToObjectSpace(ray);
+  objectRay.tMax = tMax;
+  return mesh->OccludedFaces(objectRay);
+}
+
+bool MeshInstance::GetBounds(AABB &bounds) const {
+  AABB objectBounds;
+  if (!mesh->GetBounds(objectBounds)) return false;
+
+  bounds = AABB();
+  for (unsigned corner = 0; corner < 8; corner++) {
+    Vector3r point(objectBounds.bounds[corner & 1].x,
+                   objectBounds.bounds[(corner >> 1) & 1].y,
+                   objectBounds.bounds[(corner >> 2) & 1].z),
+        worldPoint;
+    objectToWorld.MultVecMatrix(point, worldPoint);
+    bounds.Expand(worldPoint);
+  }
+  return true;
+}
+
+size_t MeshInstance::GetMemoryUsage() const { return sizeof(MeshInstance); }
@@ -0,0 +1,30 @@
+#pragma once
+#include <memory>
+#include "Matrix44.h"
+#include "Object.h"
+#include "TriangleMesh.h"
+
+// Places a shared TriangleMesh in the scene with its own transform and
+// material. Rays are moved into the mesh's object space, so one mesh and
+// one face accelerator serve every instance and memory stays flat however
+// many there are. Mirroring transforms flip the winding, which the back face
+// culling of the triangle test doesn't account for
+class MeshInstance : public Object {
+ public:
+  MeshInstance(std::shared_ptr<const TriangleMesh> mesh_,
+               const Matrix44r &objectToWorld_);
+
+  bool Intersect(const Ray &ray, Hit &hit) const;
+  bool Occluded(const Ray &ray, const Real tMax) const;
+  bool GetBounds(AABB &bounds) const;
+  // The shared mesh isn't counted, it's held by all the instances
+  size_t GetMemoryUsage() const;
+
+ private:
+  Ray ToObjectSpace(const Ray &ray) const;
+
+  std::shared_ptr<const TriangleMesh> mesh;
+  Matrix44r objectToWorld, worldToObject;
+  // Normals go back to world space with the inverse transpose
+  Matrix44r normalToWorld;
+};
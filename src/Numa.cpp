@@ -0,0 +1,78 @@
+#include "Numa.h"
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+std::vector<unsigned> ParseCpuList(const std::string &list) {
+  std::vector<unsigned> cpus;
+  std::stringstream stream(list);
+  std::string range;
+  while (std::getline(stream, range, ',')) {
+    unsigned first, last;
+    char dash;
+    std::stringstream rangeStream(range);
+    if (!(rangeStream >> first)) continue;
+    last = first;
+    if (rangeStream >> dash && dash == '-') rangeStream >> last;
+    for (unsigned cpu = first; cpu <= last; cpu++) cpus.emplace_back(cpu);
+  }
+  return cpus;
+}
+
+NumaTopology NumaTopology::Read(const std::string &directory) {
+  NumaTopology topology;
+  for (unsigned node = 0;; node++) {
+    std::ifstream file(directory + "/node" + std::to_string(node) +
+                       "/cpulist");
+    if (!file) break;
+    std::string list;
+    std::getline(file, list);
+    std::vector<unsigned> cpus = ParseCpuList(list);
+    // Nodes with memory but no CPUs don't get workers
+    if (!cpus.empty()) topology.nodeCpus.emplace_back(std::move(cpus));
+  }
+
+  if (topology.nodeCpus.empty()) {
+    topology.nodeCpus.emplace_back();
+    unsigned cpuCount = std::max(1u, std::thread::hardware_concurrency());
+    for (unsigned cpu = 0; cpu < cpuCount; cpu++)
+      topology.nodeCpus[0].emplace_back(cpu);
+  }
+  return topology;
+}
+
+unsigned NumaTopology::WorkerCpu(const unsigned worker,
+                                 const ThreadAffinity affinity,
+                                 unsigned &node) const {
+  if (affinity == ThreadAffinity::Scatter) {
+    node = worker % NodeCount();
+    const std::vector<unsigned> &cpus = nodeCpus[node];
+    return cpus[worker / NodeCount() % cpus.size()];
+  }
+
+  // Compact, more workers than CPUs wrap around to the first node
+  size_t cpuCount = 0;
+  for (const auto &cpus : nodeCpus) cpuCount += cpus.size();
+  size_t index = worker % cpuCount;
+  for (node = 0; index >= nodeCpus[node].size(); node++)
+    index -= nodeCpus[node].size();
+  return nodeCpus[node][index];
+}
+
+bool PinThread(const unsigned cpu) {
+#ifdef __linux__
+  if (cpu >= CPU_SETSIZE) return false;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+  (void)cpu;
+  return false;
+#endif
+}
@@ -0,0 +1,37 @@
+#pragma once
+#include <string>
+#include <vector>
+
+// Where worker threads are pinned on machines with several NUMA nodes
+enum class ThreadAffinity {
+  None,     // left to the OS scheduler
+  Compact,  // fill the CPUs of one node before using the next
+  Scatter   // round robin over the nodes
+};
+constexpr ThreadAffinity THREAD_AFFINITY = ThreadAffinity::None;
+// With pinned workers, build a copy of the scene on each node so traversal
+// only reads memory local to the worker
+constexpr bool NUMA_REPLICATE_SCENE = false;
+// Linux sysfs node directories (node0/cpulist, ...). Point it at a fake tree
+// to try topologies the machine doesn't have
+constexpr const char *NUMA_NODE_DIRECTORY = "/sys/devices/system/node";
+
+// CPUs of each NUMA node
+struct NumaTopology {
+  std::vector<std::vector<unsigned>> nodeCpus;
+
+  // Reads directory/node<N>/cpulist, a single node with every hardware
+  // thread if there are none
+  static NumaTopology Read(const std::string &directory);
+
+  unsigned NodeCount() const { return unsigned(nodeCpus.size()); }
+  // CPU worker is pinned to under the policy and the node it belongs to
+  unsigned WorkerCpu(const unsigned worker, const ThreadAffinity affinity,
+                     unsigned &node) const;
+};
+
+// Parses a sysfs CPU list such as "0-3,8-11"
+std::vector<unsigned> ParseCpuList(const std::string &list);
+
+// Restricts the calling thread to one CPU, false if the OS refused
+bool PinThread(const unsigned cpu);
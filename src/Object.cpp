@@ -4,8 +4,15 @@ Object::Object() noexcept {}
 
 Object::~Object() {}
 
-double Object::GetIntersection(const Ray &) { return 0; }
+bool Object::Intersect(const Ray &, Hit &) const { return false; }
 
-Vector3d Object::GetNormalAt(const Vector3d &) { return 0; }
+bool Object::Occluded(const Ray &ray, const Real tMax) const {
+  Ray shadowRay = ray;
+  shadowRay.tMax = tMax;
+  Hit hit;
+  return Intersect(shadowRay, hit);
+}
 
-Vector3d Object::GetTexCoords(Vector3d &, const Vector3d &) { return 0; }
+bool Object::GetBounds(AABB &) const { return false; }
+
+size_t Object::GetMemoryUsage() const { return sizeof(Object); }
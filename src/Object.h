@@ -1,17 +1,40 @@
 #pragma once
+#include "AABB.h"
 #include "Color.h"
 #include "Material.h"
 #include "Ray.h"
 #include "Vector3.h"
 
+// Everything shading needs to know about a ray hit. Objects fill it in
+// Intersect, so nothing about the last hit is kept in the object itself and
+// one scene can be traced by any number of threads
+struct Hit {
+  Real t = -1;
+  int object = -1;         // index in the scene object list, set by the scene
+  unsigned primitive = 0;  // face of a mesh, 0 for single primitive objects
+  Real u = 0, v = 0;     // barycentric coordinates on triangles
+  Vector3r normal;         // shading normal
+  // Normal of the surface itself, rays leaving the hit are offset along it
+  // since shading normals can point through the surface
+  Vector3r geometricNormal;
+  Vector3r uv;             // texture coordinates, 0 if the object has none
+};
+
 class Object {
  public:
   Object() noexcept;
   virtual ~Object();
 
-  virtual double GetIntersection(const Ray &ray);
-  virtual Vector3d GetNormalAt(const Vector3d &intersectionPosition);
-  virtual Vector3d GetTexCoords(Vector3d &normal, const Vector3d &hitPoint);
+  // Closest hit between BIAS and ray.tMax, fills everything in the hit
+  // record but the object index
+  virtual bool Intersect(const Ray &ray, Hit &hit) const;
+  // Whether anything of the object blocks the ray before tMax. Shadow rays
+  // only need this, overrides can stop at the first blocker they find
+  virtual bool Occluded(const Ray &ray, const Real tMax) const;
+  // World space bounds, false for unbounded objects (planes)
+  virtual bool GetBounds(AABB &bounds) const;
+  // Bytes held by the object, including any geometry it owns
+  virtual size_t GetMemoryUsage() const;
 
   Material material;
 };
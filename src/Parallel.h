@@ -0,0 +1,32 @@
+#pragma once
+#include <algorithm>
+#include <thread>
+#include "Globals.h"
+#include "ThreadPool.h"
+
+// Number of worker threads used for rendering and for parallel builds
+inline unsigned ThreadCount() {
+  if (THREADS) return THREADS;
+  return std::max(1u, std::thread::hardware_concurrency());
+}
+
+// Splits [0, count) into one contiguous chunk per thread and calls
+// func(begin, end, chunkIndex) for each chunk on the GlobalPool(). The
+// calling thread works on chunks too until all of them are done
+template <typename Func>
+void ParallelFor(const size_t count, const unsigned nThreads, Func &&func) {
+  unsigned chunks = unsigned(std::min<size_t>(nThreads, count));
+  if (chunks <= 1) {
+    if (count) func(size_t(0), count, 0u);
+    return;
+  }
+
+  ThreadPool &pool = GlobalPool();
+  TaskGroup group;
+  size_t chunk = count / chunks;
+  for (unsigned i = 0; i < chunks; i++)
+    pool.Submit(group, [&func, i, chunk, chunks, count] {
+      func(i * chunk, i + 1 < chunks ? (i + 1) * chunk : count, i);
+    });
+  pool.Wait(group);
+}
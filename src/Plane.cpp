@@ -2,28 +2,35 @@
 
 Plane::Plane() : center{0, -1, 0}, normal{1, 0, 0} {}
 
-Plane::Plane(Vector3d center_, Vector3d normal_)
+Plane::Plane(Vector3r center_, Vector3r normal_)
     : center{center_}, normal{normal_} {}
 
-Vector3d Plane::GetNormalAt(const Vector3d &) { return normal; }
+bool Plane::Intersect(const Ray &ray, Hit &hit) const {
+  return Intersect(center, normal, ray, hit);
+}
 
-double Plane::GetIntersection(const Ray &ray) {
-  double denom = normal.Dot(ray.GetDirection());
+bool Plane::Intersect(const Vector3r &center, const Vector3r &normal,
+                      const Ray &ray, Hit &hit) {
+  Real denom = normal.Dot(ray.GetDirection());
   if (std::fabs(denom) > BIAS) {
-    double t = (center - ray.GetOrigin()).Dot(normal) / denom;
-    if (t > BIAS) return t;
+    Real t = (center - ray.GetOrigin()).Dot(normal) / denom;
+    if (t > BIAS && t < ray.tMax) {
+      hit.t = t;
+      hit.normal = hit.geometricNormal = normal;
+      return true;
+    }
   }
   return false;
 }
 
-double Plane::GetIntersectionDisk(Ray ray, Vector3d normal_,
-                                  Vector3d position) {
-  double denom = normal_.Dot(ray.GetDirection());
-  double t = -1;
+Real Plane::GetIntersectionDisk(Ray ray, Vector3r normal_,
+                                Vector3r position) {
+  Real denom = normal_.Dot(ray.GetDirection());
+  Real t = -1;
   if (std::fabs(denom) > ray.tMin && t <= ray.tMax) {
     t = (position - ray.GetOrigin()).Dot(normal_) / denom;
   }
   return t;
 }
 
-Vector3d Plane::GetCenter() const { return center; }
+Vector3r Plane::GetCenter() const { return center; }
@@ -7,14 +7,18 @@
 class Plane : public Object {
  public:
   Plane();
-  Plane(Vector3d center_, Vector3d normal_);
+  Plane(Vector3r center_, Vector3r normal_);
 
-  virtual Vector3d GetNormalAt(const Vector3d &point);
-  virtual double GetIntersection(const Ray &ray);
-  double GetIntersectionDisk(const Ray ray, const Vector3d normal_,
-                             const Vector3d position);
-  Vector3d GetCenter() const;
+  virtual bool Intersect(const Ray &ray, Hit &hit) const;
+  // Shared with the flat plane array of SceneAccelerator
+  static bool Intersect(const Vector3r &center, const Vector3r &normal,
+                        const Ray &ray, Hit &hit);
+  size_t GetMemoryUsage() const { return sizeof(Plane); }
+  static Real GetIntersectionDisk(const Ray ray, const Vector3r normal_,
+                                  const Vector3r position);
+  Vector3r GetCenter() const;
+  Vector3r GetNormal() const { return normal; }
 
  private:
-  Vector3d normal, center;
+  Vector3r normal, center;
 };
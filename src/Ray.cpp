@@ -1,39 +1,73 @@
 #include "Ray.h"
+#include <cstring>
 
 Ray::Ray() {
-  origin = Vector3d(0);
-  direction = Vector3d(0, 0, 1);
+  origin = Vector3r(0);
   tMin = BIAS;
   tMax = 1000;
 
-  invDir.x = 1 / direction.x;
-  invDir.y = 1 / direction.y;
-  invDir.z = 1 / direction.z;
-
-  sign[0] = (invDir.x < 0);
-  sign[1] = (invDir.y < 0);
-  sign[2] = (invDir.z < 0);
+  SetDirection(Vector3r(0, 0, 1));
 }
 
-Ray::Ray(const Vector3d origin_, const Vector3d direction_) {
+Ray::Ray(const Vector3r origin_, const Vector3r direction_) {
   origin = origin_;
-  direction = direction_;
   tMin = BIAS;
   tMax = 100000;
 
-  invDir.x = 1 / direction_.x;
-  invDir.y = 1 / direction_.y;
-  invDir.z = 1 / direction_.z;
+  SetDirection(direction_);
+}
+
+void Ray::SetOrigin(const Vector3r &origin_) { origin = origin_; }
 
-  sign[0] = (invDir.x < 0);
-  sign[1] = (invDir.y < 0);
-  sign[2] = (invDir.z < 0);
+void Ray::SetDirection(const Vector3r &direction_) {
+  direction = direction_;
+
+  // -Ofast assumes finite math, so never divide by an exact zero component
+  // (axis aligned rays), nudge it instead to keep the slab tests valid
+  for (uint8_t i = 0; i < 3; i++) {
+    Real d = direction[i];
+    if (std::fabs(d) < 1e-12) d = std::copysign(Real(1e-12), d);
+    invDir[i] = 1 / d;
+    sign[i] = (invDir[i] < 0);
+  }
 }
 
-void Ray::SetOrigin(const Vector3d &origin_) { origin = origin_; }
+Vector3r Ray::GetOrigin() const { return origin; }
 
-void Ray::SetDirection(const Vector3d &direction_) { direction = direction_; }
+Vector3r Ray::GetDirection() const { return direction; }
 
-Vector3d Ray::GetOrigin() const { return origin; }
+namespace {
+// Offsets along a unit normal: OFFSET_ULPS ulps for coordinates away from
+// zero, OFFSET_NEAR_ZERO for those within OFFSET_ORIGIN of it, where ulps get
+// too small to matter. The single precision values are the paper's, the
+// double precision ones give the same margin over double rounding errors
+#ifdef TRACEY_SINGLE_PRECISION
+typedef int32_t RealBits;
+constexpr Real OFFSET_NEAR_ZERO = 1.0f / 65536;
+#else
+typedef int64_t RealBits;
+constexpr Real OFFSET_NEAR_ZERO = 1.0 / (1ll << 45);
+#endif
+constexpr Real OFFSET_ULPS = 256;
+constexpr Real OFFSET_ORIGIN = 1.0 / 32;
+}  // namespace
 
-Vector3d Ray::GetDirection() const { return direction; }
+Vector3r OffsetRayOrigin(const Vector3r &point, const Vector3r &normal,
+                         const Vector3r &direction) {
+  const Vector3r n = normal.Dot(direction) < 0 ? -normal : normal;
+  Vector3r origin;
+  for (uint8_t i = 0; i < 3; i++) {
+    if (std::fabs(point[i]) < OFFSET_ORIGIN) {
+      origin[i] = point[i] + OFFSET_NEAR_ZERO * n[i];
+      continue;
+    }
+    // Stepping the bit pattern moves away from zero for positive and
+    // negative values alike, hence the sign flip
+    const RealBits ulps = RealBits(OFFSET_ULPS * n[i]);
+    RealBits bits;
+    std::memcpy(&bits, &point[i], sizeof(bits));
+    bits += point[i] < 0 ? -ulps : ulps;
+    std::memcpy(&origin[i], &bits, sizeof(bits));
+  }
+  return origin;
+}
@@ -4,17 +4,25 @@
 struct Ray {
  public:
   Ray();
-  Ray(const Vector3d origin_, const Vector3d direction_);
+  Ray(const Vector3r origin_, const Vector3r direction_);
 
-  void SetOrigin(const Vector3d &origin_);
-  void SetDirection(const Vector3d &direction_);
-  Vector3d GetOrigin() const;
-  Vector3d GetDirection() const;
+  void SetOrigin(const Vector3r &origin_);
+  void SetDirection(const Vector3r &direction_);
+  Vector3r GetOrigin() const;
+  Vector3r GetDirection() const;
 
-  Vector3d invDir;
-  double tMin, tMax;
+  Vector3r invDir;
+  Real tMin, tMax;
   int sign[3];
 
  private:
-  Vector3d origin, direction;
+  Vector3r origin, direction;
 };
+
+// Origin for a ray leaving point, a hit on a surface with the given normal,
+// towards direction. Moves it off the surface by a fixed number of ulps per
+// coordinate, so the offset grows with the rounding error of the hit point
+// and the ray can't hit the surface it leaves again (Waechter and Binder, "A
+// Fast and Robust Method for Avoiding Self-Intersection", Ray Tracing Gems)
+Vector3r OffsetRayOrigin(const Vector3r &point, const Vector3r &normal,
+                         const Vector3r &direction);
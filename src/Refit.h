@@ -0,0 +1,54 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <utility>
+#include <vector>
+#include "Parallel.h"
+
+constexpr unsigned REFIT_TASKS_PER_THREAD = 8;
+
+// Refits a depth first tree in parallel. Subtrees are contiguous ranges of
+// nodes whose children come after their parent, so a subtree is refitted
+// by one thread walking its range backwards. The nodes above the subtrees
+// are refitted last, also children first.
+// splitRange(start, end, children) appends the child ranges of the subtree
+// [start, end) rooted at start, none for leaves. refitNode(index)
+// recomputes one node from its children / primitives
+template <typename SplitRange, typename RefitNode>
+void RefitTree(const unsigned nodeCount, const SplitRange &splitRange,
+               const RefitNode &refitNode) {
+  using Range = std::pair<unsigned, unsigned>;
+  auto size = [](const Range &range) { return range.second - range.first; };
+
+  // Split the largest subtree until every thread has a few to pick from
+  const unsigned nThreads = ThreadCount();
+  std::vector<Range> tasks = {{0, nodeCount}}, children;
+  std::vector<unsigned> top;
+  while (nThreads > 1 && tasks.size() < nThreads * REFIT_TASKS_PER_THREAD) {
+    auto largest =
+        std::max_element(tasks.begin(), tasks.end(),
+                         [&](const Range &a, const Range &b) {
+                           return size(a) < size(b);
+                         });
+    children.clear();
+    splitRange(largest->first, largest->second, children);
+    if (children.empty()) break;
+
+    top.emplace_back(largest->first);
+    *largest = children[0];
+    tasks.insert(tasks.end(), children.begin() + 1, children.end());
+  }
+
+  // Largest first, threads pull the next one as they finish
+  std::sort(tasks.begin(), tasks.end(), [&](const Range &a, const Range &b) {
+    return size(a) > size(b);
+  });
+  std::atomic<size_t> next(0);
+  ParallelFor(nThreads, nThreads, [&](size_t, size_t, unsigned) {
+    for (size_t task = next++; task < tasks.size(); task = next++)
+      for (unsigned i = tasks[task].second; i-- > tasks[task].first;)
+        refitNode(i);
+  });
+
+  for (auto node = top.rbegin(); node != top.rend(); ++node) refitNode(*node);
+}
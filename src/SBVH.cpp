@@ -0,0 +1,244 @@
+#include "BVH.h"
+
+// Spatial split BVH (Stich et al. 2009). Builds like the SAH builder, but
+// where the children of the best object split overlap it also tries
+// splitting space: primitives straddling the plane are then referenced from
+// both children, with their bounds clipped to each side
+
+void BVH::BuildSBVH(const std::vector<AABB> &primBounds,
+                    const PrimitiveIntersector &primitives) {
+  std::vector<BuildPrimitive> refs(primBounds.size());
+  AABB rootBounds;
+  for (unsigned i = 0; i < primBounds.size(); i++) {
+    refs[i].bounds = primBounds[i];
+    refs[i].centroid = primBounds[i].Centroid();
+    refs[i].index = i;
+    rootBounds.Expand(primBounds[i]);
+  }
+
+  size_t duplicationBudget =
+      size_t(std::max(0.0, settings.maxDuplication) * primBounds.size());
+  BuildSBVHRecursive(refs, 1, rootBounds.SurfaceArea(), duplicationBudget,
+                     primitives);
+}
+
+void BVH::SplitReference(const BuildPrimitive &ref, const int axis,
+                         const Real position,
+                         const PrimitiveIntersector &primitives,
+                         BuildPrimitive &left, BuildPrimitive &right) {
+  primitives.SplitPrimitive(ref.index, axis, position, left.bounds,
+                            right.bounds);
+  left.bounds.Clip(ref.bounds);
+  right.bounds.Clip(ref.bounds);
+  left.bounds.bounds[1][axis] = std::min(left.bounds.bounds[1][axis], position);
+  right.bounds.bounds[0][axis] =
+      std::max(right.bounds.bounds[0][axis], position);
+
+  left.index = right.index = ref.index;
+  left.centroid = left.bounds.Centroid();
+  right.centroid = right.bounds.Centroid();
+}
+
+unsigned BVH::BuildSBVHRecursive(std::vector<BuildPrimitive> &refs,
+                                 const unsigned nodeDepth,
+                                 const double rootArea,
+                                 size_t &duplicationBudget,
+                                 const PrimitiveIntersector &primitives) {
+  depth = std::max(depth, nodeDepth);
+  unsigned nodeIndex = nodes.size();
+  nodes.emplace_back();
+
+  AABB bounds, centroidBounds;
+  for (const auto &ref : refs) {
+    bounds.Expand(ref.bounds);
+    centroidBounds.Expand(ref.centroid);
+  }
+  nodes[nodeIndex].bounds = bounds;
+
+  // Leaves own their slice of primIndices, references of split primitives
+  // can appear in several leaves
+  const unsigned count = refs.size();
+  auto makeLeaf = [&]() {
+    nodes[nodeIndex].offset = primIndices.size();
+    nodes[nodeIndex].count = count;
+    nodes[nodeIndex].axis = 0;
+    for (const auto &ref : refs) primIndices.emplace_back(ref.index);
+    return nodeIndex;
+  };
+  if (count <= 2 || nodeDepth >= BVH_MAX_DEPTH) return makeLeaf();
+
+  struct Bin {
+    AABB bounds;
+    unsigned count = 0;
+  };
+
+  // Object split, binned SAH over the centroids of every axis
+  double bestCost = std::numeric_limits<double>::max();
+  int bestAxis = -1;
+  unsigned bestBin = 0;
+  AABB objectLeft, objectRight;
+  for (int axis = 0; axis < 3; axis++) {
+    const double axisMin = centroidBounds.bounds[0][axis];
+    const double axisExtent = centroidBounds.bounds[1][axis] - axisMin;
+    if (axisExtent <= 0) continue;
+
+    Bin bins[BVH_SAH_BINS];
+    const double binScale = BVH_SAH_BINS / axisExtent;
+    for (const auto &ref : refs) {
+      unsigned b =
+          std::min(unsigned((ref.centroid[axis] - axisMin) * binScale),
+                   BVH_SAH_BINS - 1);
+      bins[b].count++;
+      bins[b].bounds.Expand(ref.bounds);
+    }
+
+    AABB rightBounds[BVH_SAH_BINS];
+    unsigned rightCount[BVH_SAH_BINS];
+    AABB rightSum;
+    unsigned rightTotal = 0;
+    for (unsigned b = BVH_SAH_BINS - 1; b > 0; b--) {
+      rightSum.Expand(bins[b].bounds);
+      rightTotal += bins[b].count;
+      rightBounds[b] = rightSum;
+      rightCount[b] = rightTotal;
+    }
+
+    AABB leftBounds;
+    unsigned leftCount = 0;
+    for (unsigned b = 1; b < BVH_SAH_BINS; b++) {
+      leftBounds.Expand(bins[b - 1].bounds);
+      leftCount += bins[b - 1].count;
+      double cost = leftBounds.SurfaceArea() * leftCount +
+                    rightBounds[b].SurfaceArea() * rightCount[b];
+      if (leftCount && rightCount[b] && cost < bestCost) {
+        bestCost = cost;
+        bestAxis = axis;
+        bestBin = b;
+        objectLeft = leftBounds;
+        objectRight = rightBounds[b];
+      }
+    }
+  }
+
+  // Spatial split, only where the object split children overlap and there
+  // is duplication budget left
+  bool spatial = false;
+  double spatialPosition = 0;
+  AABB overlap = objectLeft;
+  overlap.Clip(objectRight);
+  if (duplicationBudget &&
+      (bestAxis < 0 ||
+       overlap.SurfaceArea() > SBVH_OVERLAP_THRESHOLD * rootArea)) {
+    for (int axis = 0; axis < 3; axis++) {
+      const double axisMin = bounds.bounds[0][axis];
+      const double binWidth =
+          (bounds.bounds[1][axis] - axisMin) / SBVH_SPATIAL_BINS;
+      if (binWidth <= 0) continue;
+
+      struct SpatialBin {
+        AABB bounds;
+        unsigned entries = 0, exits = 0;
+      } bins[SBVH_SPATIAL_BINS];
+      auto binOf = [&](const double v) {
+        int b = int((v - axisMin) / binWidth);
+        return unsigned(std::max(0, std::min(b, int(SBVH_SPATIAL_BINS) - 1)));
+      };
+
+      // Chop every reference into the bins it spans
+      for (const auto &ref : refs) {
+        unsigned first = binOf(ref.bounds.bounds[0][axis]);
+        unsigned last = binOf(ref.bounds.bounds[1][axis]);
+        BuildPrimitive current = ref;
+        for (unsigned b = first; b < last; b++) {
+          BuildPrimitive left, right;
+          SplitReference(current, axis, axisMin + binWidth * (b + 1),
+                         primitives, left, right);
+          bins[b].bounds.Expand(left.bounds);
+          current = right;
+        }
+        bins[last].bounds.Expand(current.bounds);
+        bins[first].entries++;
+        bins[last].exits++;
+      }
+
+      double rightArea[SBVH_SPATIAL_BINS];
+      unsigned rightCount[SBVH_SPATIAL_BINS];
+      AABB rightBounds;
+      unsigned rightTotal = 0;
+      for (unsigned b = SBVH_SPATIAL_BINS - 1; b > 0; b--) {
+        rightBounds.Expand(bins[b].bounds);
+        rightTotal += bins[b].exits;
+        rightArea[b] = rightBounds.SurfaceArea();
+        rightCount[b] = rightTotal;
+      }
+
+      AABB leftBounds;
+      unsigned leftCount = 0;
+      for (unsigned b = 1; b < SBVH_SPATIAL_BINS; b++) {
+        leftBounds.Expand(bins[b - 1].bounds);
+        leftCount += bins[b - 1].entries;
+        const size_t duplicates = leftCount + rightCount[b] - count;
+        double cost =
+            leftBounds.SurfaceArea() * leftCount + rightArea[b] * rightCount[b];
+        if (leftCount && rightCount[b] && duplicates <= duplicationBudget &&
+            cost < bestCost) {
+          bestCost = cost;
+          bestAxis = axis;
+          spatial = true;
+          spatialPosition = axisMin + binWidth * b;
+        }
+      }
+    }
+  }
+
+  const double parentArea = bounds.SurfaceArea();
+  const double splitCost =
+      BVH_TRAVERSAL_COST +
+      (parentArea > 0 ? bestCost / parentArea
+                      : std::numeric_limits<double>::max());
+  if (bestAxis < 0 || (count <= BVH_MAX_LEAF_SIZE && splitCost >= count))
+    return makeLeaf();
+
+  std::vector<BuildPrimitive> left, right;
+  if (spatial) {
+    for (const auto &ref : refs) {
+      if (ref.bounds.bounds[1][bestAxis] <= spatialPosition)
+        left.emplace_back(ref);
+      else if (ref.bounds.bounds[0][bestAxis] >= spatialPosition)
+        right.emplace_back(ref);
+      else {
+        BuildPrimitive leftRef, rightRef;
+        SplitReference(ref, bestAxis, spatialPosition, primitives, leftRef,
+                       rightRef);
+        bool inLeft = !leftRef.bounds.IsEmpty();
+        bool inRight = !rightRef.bounds.IsEmpty();
+        if (inLeft) left.emplace_back(leftRef);
+        if (inRight) right.emplace_back(rightRef);
+        if (inLeft && inRight && duplicationBudget) duplicationBudget--;
+      }
+    }
+  } else {
+    const double axisMin = centroidBounds.bounds[0][bestAxis];
+    const double binScale =
+        BVH_SAH_BINS / (centroidBounds.bounds[1][bestAxis] - axisMin);
+    for (const auto &ref : refs) {
+      unsigned b =
+          std::min(unsigned((ref.centroid[bestAxis] - axisMin) * binScale),
+                   BVH_SAH_BINS - 1);
+      (b < bestBin ? left : right).emplace_back(ref);
+    }
+  }
+  if (left.empty() || right.empty()) return makeLeaf();
+
+  // The references are not needed any more, free them before recursing
+  std::vector<BuildPrimitive>().swap(refs);
+
+  nodes[nodeIndex].count = 0;
+  nodes[nodeIndex].axis = bestAxis;
+  BuildSBVHRecursive(left, nodeDepth + 1, rootArea, duplicationBudget,
+                     primitives);
+  unsigned rightIndex = BuildSBVHRecursive(right, nodeDepth + 1, rootArea,
+                                           duplicationBudget, primitives);
+  nodes[nodeIndex].offset = rightIndex;
+  return nodeIndex;
+}
@@ -6,53 +6,53 @@ std::vector<std::shared_ptr<Object>> Scene::InitObjects() {
   // orangeM;
 
   std::shared_ptr<Plane> floorPlane =
-      std::make_shared<Plane>(Vector3d(0, 0, 0), Vector3d(0, 1, 0));
+      std::make_shared<Plane>(Vector3r(0, 0, 0), Vector3r(0, 1, 0));
   floorPlane->material = tileFloorM;
   std::shared_ptr<Plane> topPlane =
-      std::make_shared<Plane>(Vector3d(0, 10, 0), Vector3d(0, -1, 0));
+      std::make_shared<Plane>(Vector3r(0, 10, 0), Vector3r(0, -1, 0));
   topPlane->material = blueM;
   std::shared_ptr<Plane> backPlane =
-      std::make_shared<Plane>(Vector3d(0, 0, 10), Vector3d(0, 0, -1));
+      std::make_shared<Plane>(Vector3r(0, 0, 10), Vector3r(0, 0, -1));
   backPlane->material = orangeM;
   std::shared_ptr<Plane> behindPlane =
-      std::make_shared<Plane>(Vector3d(0, 0, -10), Vector3d(0, 0, 1));
+      std::make_shared<Plane>(Vector3r(0, 0, -10), Vector3r(0, 0, 1));
   behindPlane->material = prettyGreenM;
   std::shared_ptr<Plane> leftPlane =
-      std::make_shared<Plane>(Vector3d(-12, 0, 0), Vector3d(1, 0, 0));
+      std::make_shared<Plane>(Vector3r(-12, 0, 0), Vector3r(1, 0, 0));
   leftPlane->material = yellowM;
   std::shared_ptr<Plane> rightPlane =
-      std::make_shared<Plane>(Vector3d(12, 0, 0), Vector3d(-1, 0, 0));
+      std::make_shared<Plane>(Vector3r(12, 0, 0), Vector3r(-1, 0, 0));
   rightPlane->material = maroonM;
 
   std::shared_ptr<Sphere> sphere1 =
-      std::make_shared<Sphere>(0.5, Vector3d(1, 0.5, -2.5));
+      std::make_shared<Sphere>(0.5, Vector3r(1, 0.5, -2.5));
   sphere1->material = maroonM;
   std::shared_ptr<Sphere> sphere2 =
-      std::make_shared<Sphere>(1.3, Vector3d(-3.2, 1.3, -2.2));
+      std::make_shared<Sphere>(1.3, Vector3r(-3.2, 1.3, -2.2));
   sphere2->material = mirrorM;
   std::shared_ptr<Sphere> sphere3 = std::make_shared<Sphere>(
       0.4,
-      Vector3d(0, sphere1->GetCenter().y + 1.5, sphere1->GetCenter().z + 1.7));
+      Vector3r(0, sphere1->GetCenter().y + 1.5, sphere1->GetCenter().z + 1.7));
   sphere3->material = checkerSphereM;
   std::shared_ptr<Sphere> sphere4 = std::make_shared<Sphere>(
-      0.2, Vector3d(sphere1->GetCenter().x - 1, sphere1->GetCenter().y + 1.8,
+      0.2, Vector3r(sphere1->GetCenter().x - 1, sphere1->GetCenter().y + 1.8,
                     sphere1->GetCenter().z + 1.2));
   sphere4->material = blueM;
   std::shared_ptr<Sphere> sphere5 =
-      std::make_shared<Sphere>(0.8, Vector3d(floorPlane->GetCenter().x + 2, 1.5,
+      std::make_shared<Sphere>(0.8, Vector3r(floorPlane->GetCenter().x + 2, 1.5,
                                              floorPlane->GetCenter().z - 1));
   sphere5->material = mirrorM;
   std::shared_ptr<Sphere> sphere6 =
-      std::make_shared<Sphere>(0.35, Vector3d(floorPlane->GetCenter().x + 0.25,
+      std::make_shared<Sphere>(0.35, Vector3r(floorPlane->GetCenter().x + 0.25,
                                               floorPlane->GetCenter().y + 1,
                                               floorPlane->GetCenter().z + 4));
   sphere6->material = glassM;
   std::shared_ptr<Sphere> sphere7 = std::make_shared<Sphere>(
-      0.4, Vector3d(sphere2->GetCenter().x + 0.55, sphere1->GetCenter().y + 2,
+      0.4, Vector3r(sphere2->GetCenter().x + 0.55, sphere1->GetCenter().y + 2,
                     sphere1->GetCenter().z + 7));
   sphere7->material = transparentM;
   std::shared_ptr<Sphere> sphere8 = std::make_shared<Sphere>(
-      0.5, Vector3d(floorPlane->GetCenter().x - 2.1, 0.5,
+      0.5, Vector3r(floorPlane->GetCenter().x - 2.1, 0.5,
                     floorPlane->GetCenter().z + 0.5));
   sphere8->material = mirrorM;
 
@@ -79,10 +79,41 @@ std::vector<std::shared_ptr<Object>> Scene::InitObjects() {
   return sceneObjects;
 }
 
+void Scene::BuildAccelerator(const Accelerator::Settings &settings) {
+  accelerator.Build(sceneObjects, settings);
+  lightTree.Build(lightSources);
+  materials.clear();
+  for (const auto &object : sceneObjects)
+    materials.emplace_back(object->material);
+}
+
+unsigned Scene::SampleLights(const Vector3r &point, std::minstd_rand &rng,
+                             LightSample samples[LIGHT_SAMPLES]) const {
+  if (lightSources.size() <= LIGHT_SAMPLES) {
+    for (unsigned i = 0; i < lightSources.size(); i++) samples[i] = {i, 1};
+    return lightSources.size();
+  }
+
+  std::uniform_real_distribution<double> uniform(0, 1);
+  for (unsigned i = 0; i < LIGHT_SAMPLES; i++) {
+    double pdf;
+    samples[i].light = lightTree.Sample(point, uniform(rng), pdf);
+    samples[i].weight = 1 / (pdf * LIGHT_SAMPLES);
+  }
+  return LIGHT_SAMPLES;
+}
+
+size_t Scene::GetMemoryUsage() const {
+  size_t bytes = accelerator.GetMemoryUsage();
+  for (const auto &object : sceneObjects) bytes += object->GetMemoryUsage();
+  return bytes + lightSources.size() * sizeof(Light) +
+         materials.size() * sizeof(Material);
+}
+
 std::vector<std::shared_ptr<Light>> Scene::InitLightSources() {
   lightSources.reserve(1);
-  Vector3d light1Position(-2, 3, 1);
-  Vector3d light2Position(0, 2, 3);
+  Vector3r light1Position(-2, 3, 1);
+  Vector3r light2Position(0, 2, 3);
   std::shared_ptr<Light> light1 =
       std::make_shared<Light>(light1Position, Color(255), 1.25, Light::POINT);
   std::shared_ptr<Light> light2 =
@@ -1,14 +1,24 @@
 #pragma once
 #include <memory>
+#include <random>
 #include <vector>
 #include "Disk.hpp"
 #include "Light.h"
+#include "LightTree.h"
 #include "Material.h"
+#include "MeshInstance.h"
 #include "Plane.h"
+#include "SceneAccelerator.h"
 #include "Sphere.h"
 #include "Triangle.h"
 #include "TriangleMesh.h"
 
+// A light to shade a point with and the weight of its contribution
+struct LightSample {
+  unsigned light;
+  double weight;
+};
+
 class Scene {
  public:
   std::vector<std::shared_ptr<Light>> lightSources;
@@ -16,6 +26,44 @@ class Scene {
 
   std::vector<std::shared_ptr<Object>> InitObjects();
   std::vector<std::shared_ptr<Light>> InitLightSources();
+  // Builds the object accelerator and the light tree
+  void BuildAccelerator(
+      const Accelerator::Settings &settings = Accelerator::Settings());
+  // Objects, meshes and acceleration structures
+  size_t GetMemoryUsage() const;
+  // After objects moved, see SceneAccelerator::Refit
+  void RefitAccelerator() { accelerator.Refit(); }
+
+  // Closest object along the ray, see SceneAccelerator::Intersect
+  bool Intersect(const Ray &ray, Hit &hit,
+                 TraversalStats *stats = nullptr) const {
+    return accelerator.Intersect(ray, hit, stats);
+  }
+
+  // Whether anything blocks the ray before tMax, for shadow rays
+  bool Occluded(const Ray &ray, const Real tMax,
+                TraversalStats *stats = nullptr) const {
+    return accelerator.Occluded(ray, tMax, stats);
+  }
+  // Same, also gives the index of the blocking object (left as is if none)
+  bool Occluded(const Ray &ray, const Real tMax, int &occluder,
+                TraversalStats *stats = nullptr) const {
+    return accelerator.Occluded(ray, tMax, occluder, stats);
+  }
+  // Whether that one object blocks the ray before tMax
+  bool OccludedBy(const Ray &ray, const Real tMax, int object) const {
+    return accelerator.OccludeObject(object, ray, tMax);
+  }
+
+  // Material of the object hit.object refers to
+  const Material &GetMaterial(int object) const { return materials[object]; }
+
+  // Lights to shade a point with, returns how many were written. Up to
+  // LIGHT_SAMPLES lights all of them are used as they are, beyond that
+  // LIGHT_SAMPLES are picked from the light tree and weighted so the sum is
+  // on average the same as over every light
+  unsigned SampleLights(const Vector3r &point, std::minstd_rand &rng,
+                        LightSample samples[LIGHT_SAMPLES]) const;
 
   std::vector<std::shared_ptr<Object>> GetObjects() const {
     return sceneObjects;
@@ -25,6 +73,12 @@ class Scene {
   }
 
  private:
+  SceneAccelerator accelerator;
+  LightTree lightTree;
+  // Copied out of the objects when building, so shading reads them from one
+  // array instead of following a pointer per hit
+  std::vector<Material> materials;
+
   const Color black = Color(0);
   const Color blue = Color(0, 170, 255);
   const Color maroon = Color(190, 64, 64);
@@ -0,0 +1,273 @@
+#include "SceneAccelerator.h"
+#include <algorithm>
+#include "Disk.hpp"
+#include "Plane.h"
+#include "Sphere.h"
+#include "Triangle.h"
+
+void SceneAccelerator::Build(
+    const std::vector<std::shared_ptr<Object>> &sceneObjects,
+    const Accelerator::Settings &settings_) {
+  settings = settings_;
+  objects = sceneObjects;
+  GatherPrimitives();
+  boundedObjects.clear();
+  unboundedObjects.clear();
+
+  std::vector<AABB> objectBounds;
+  for (unsigned i = 0; i < objects.size(); i++) {
+    AABB bounds;
+    if (objects[i]->GetBounds(bounds)) {
+      boundedObjects.emplace_back(i);
+      objectBounds.emplace_back(bounds);
+    } else
+      unboundedObjects.emplace_back(i);
+  }
+  BuildAccelerator(objectBounds);
+}
+
+void SceneAccelerator::BuildAccelerator(
+    const std::vector<AABB> &objectBounds) {
+  accelerator = Accelerator::Create(settings);
+  accelerator->Build(objectBounds, *this);
+  builtSAHCost = accelerator->GetSAHCost();
+}
+
+void SceneAccelerator::GatherPrimitives() {
+  refs.resize(objects.size());
+  spheres.clear();
+  planes.clear();
+  disks.clear();
+  triangles.clear();
+  for (unsigned i = 0; i < objects.size(); i++) {
+    const Object *object = objects[i].get();
+    // Disk derives from Plane, so it has to be checked first
+    if (auto sphere = dynamic_cast<const Sphere *>(object)) {
+      refs[i] = {SPHERE, spheres.size()};
+      spheres.push_back(sphere->GetCenter(), sphere->GetRadius());
+    } else if (auto disk = dynamic_cast<const Disk *>(object)) {
+      refs[i] = {DISK, (unsigned)disks.size()};
+      disks.push_back(
+          {disk->GetPosition(), disk->GetNormal(), disk->GetRadius()});
+    } else if (auto plane = dynamic_cast<const Plane *>(object)) {
+      refs[i] = {PLANE, (unsigned)planes.size()};
+      planes.push_back({plane->GetCenter(), plane->GetNormal()});
+    } else if (auto triangle = dynamic_cast<const Triangle *>(object)) {
+      refs[i] = {TRIANGLE, (unsigned)triangles.size()};
+      triangles.push_back(
+          {triangle->v0, triangle->v1, triangle->v2, triangle->GetNormal()});
+    } else
+      refs[i] = {OBJECT, i};
+  }
+}
+
+void SceneAccelerator::Refit() {
+  if (!accelerator) return;  // never built
+  GatherPrimitives();
+  std::vector<AABB> objectBounds(boundedObjects.size());
+  for (unsigned i = 0; i < boundedObjects.size(); i++)
+    objects[boundedObjects[i]]->GetBounds(objectBounds[i]);
+
+  bool refitted = accelerator->Refit(objectBounds);
+  double growth =
+      (builtSAHCost > 0) ? accelerator->GetSAHCost() / builtSAHCost : 1;
+  if (!refitted || growth > settings.maxRefitGrowth)
+    BuildAccelerator(objectBounds);
+}
+
+size_t SceneAccelerator::GetMemoryUsage() const {
+  return (boundedObjects.size() + unboundedObjects.size()) * sizeof(unsigned) +
+         refs.size() * sizeof(PrimitiveRef) +
+         spheres.GetMemoryUsage() +
+         planes.size() * sizeof(PlaneData) + disks.size() * sizeof(DiskData) +
+         triangles.size() * sizeof(TriangleData) +
+         (accelerator ? accelerator->GetMemoryUsage() : 0);
+}
+
+bool SceneAccelerator::IntersectObject(unsigned object, const Ray &ray,
+                                       Hit &hit) const {
+  const PrimitiveRef ref = refs[object];
+  switch (ref.type) {
+    case SPHERE:
+      return Sphere::Intersect(spheres.GetCenter(ref.slot),
+                               spheres.radius[ref.slot], ray, hit);
+    case PLANE: {
+      const PlaneData &p = planes[ref.slot];
+      return Plane::Intersect(p.center, p.normal, ray, hit);
+    }
+    case DISK: {
+      const DiskData &d = disks[ref.slot];
+      return Disk::Intersect(d.position, d.normal, d.radius, ray, hit);
+    }
+    case TRIANGLE: {
+      const TriangleData &tri = triangles[ref.slot];
+      return Triangle::Intersect(tri.v0, tri.v1, tri.v2, tri.normal, ray, hit);
+    }
+    default:
+      return objects[object]->Intersect(ray, hit);
+  }
+}
+
+bool SceneAccelerator::OccludeObject(unsigned object, const Ray &ray,
+                                     const Real tMax) const {
+  // Only meshes have a cheaper any-hit test than the closest hit
+  if (refs[object].type == OBJECT)
+    return objects[object]->Occluded(ray, tMax);
+  Ray occlusionRay = ray;
+  occlusionRay.tMax = tMax;
+  Hit hit;
+  return IntersectObject(object, occlusionRay, hit);
+}
+
+bool SceneAccelerator::GetSphereSlots(const unsigned *indices,
+                                      const unsigned count,
+                                      unsigned *slots) const {
+  for (unsigned i = 0; i < count; i++) {
+    const PrimitiveRef ref = refs[boundedObjects[indices[i]]];
+    if (ref.type != SPHERE) return false;
+    slots[i] = ref.slot;
+  }
+  return true;
+}
+
+Real SceneAccelerator::IntersectPrimitive(unsigned index,
+                                          const Ray &ray) const {
+  Hit hit;
+  return IntersectObject(boundedObjects[index], ray, hit) ? hit.t : -1;
+}
+
+bool SceneAccelerator::OccludePrimitive(unsigned index, const Ray &ray) const {
+  return OccludeObject(boundedObjects[index], ray, ray.tMax);
+}
+
+// Keeps the whole record of the closest hit the accelerator has found so far.
+// It lives on the stack of a single query, so queries share no state
+class SceneAccelerator::ClosestHit : public PrimitiveIntersector {
+ public:
+  ClosestHit(const SceneAccelerator &scene_, Hit &hit_)
+      : scene{scene_}, hit{hit_} {}
+
+  Real IntersectPrimitive(unsigned index, const Ray &ray) const {
+    Hit candidate;
+    const unsigned object = scene.boundedObjects[index];
+    if (!scene.IntersectObject(object, ray, candidate)) return -1;
+    // Same test the accelerators accept a hit with
+    if (hit.object == -1 || candidate.t < hit.t) {
+      hit = candidate;
+      hit.object = object;
+    }
+    return candidate.t;
+  }
+
+  // Sphere only parts of the leaf go through the sphere kernel, only the
+  // nearest sphere hit gets its hit record filled in
+  Real IntersectPrimitives(const unsigned *indices, const unsigned count,
+                           const Ray &ray, Real closest,
+                           unsigned &primIndex) const {
+    Real result = -1;
+    for (unsigned first = 0; first < count; first += SPHERE_LANES) {
+      const unsigned n = std::min(count - first, SPHERE_LANES);
+      unsigned slots[SPHERE_LANES], slot;
+      Real t;
+      if (!scene.GetSphereSlots(indices + first, n, slots))
+        t = PrimitiveIntersector::IntersectPrimitives(indices + first, n, ray,
+                                                      closest, primIndex);
+      else if ((t = IntersectSpheres(scene.spheres, slots, n, ray, closest,
+                                     slot)) > 0) {
+        const unsigned i = std::find(slots, slots + n, slot) - slots;
+        primIndex = indices[first + i];
+        hit = Hit();
+        Sphere::SetHit(scene.spheres.GetCenter(slot), ray, t, hit);
+        hit.object = scene.boundedObjects[primIndex];
+      }
+      if (t > 0) closest = result = t;
+    }
+    return result;
+  }
+
+ private:
+  const SceneAccelerator &scene;
+  Hit &hit;
+};
+
+bool SceneAccelerator::Intersect(const Ray &ray, Hit &hit,
+                                 TraversalStats *stats) const {
+  hit = Hit();
+  for (unsigned index : unboundedObjects) {
+    Hit candidate;
+    if (IntersectObject(index, ray, candidate) &&
+        (hit.object == -1 || candidate.t < hit.t)) {
+      hit = candidate;
+      hit.object = index;
+    }
+  }
+
+  // Anything the accelerator finds has to be closer than the closest plane
+  Ray boundedRay = ray;
+  if (hit.object != -1) boundedRay.tMax = hit.t;
+  Hit boundedHit;
+  unsigned primIndex;
+  accelerator->Intersect(boundedRay, ClosestHit(*this, boundedHit), primIndex,
+                         stats);
+  if (boundedHit.object != -1) hit = boundedHit;
+
+  return hit.object != -1;
+}
+
+// Notes which object blocked the ray, for the caller's occluder caches
+class SceneAccelerator::AnyHit : public PrimitiveIntersector {
+ public:
+  AnyHit(const SceneAccelerator &scene_, int &occluder_)
+      : scene{scene_}, occluder{occluder_} {}
+
+  Real IntersectPrimitive(unsigned index, const Ray &ray) const {
+    return scene.IntersectPrimitive(index, ray);
+  }
+
+  bool OccludePrimitive(unsigned index, const Ray &ray) const {
+    if (!scene.OccludePrimitive(index, ray)) return false;
+    occluder = scene.boundedObjects[index];
+    return true;
+  }
+
+  bool OccludePrimitives(const unsigned *indices, const unsigned count,
+                         const Ray &ray) const {
+    for (unsigned first = 0; first < count; first += SPHERE_LANES) {
+      const unsigned n = std::min(count - first, SPHERE_LANES);
+      unsigned slots[SPHERE_LANES], slot;
+      if (!scene.GetSphereSlots(indices + first, n, slots)) {
+        if (PrimitiveIntersector::OccludePrimitives(indices + first, n, ray))
+          return true;
+      } else if (OccludeSpheres(scene.spheres, slots, n, ray, slot)) {
+        const unsigned i = std::find(slots, slots + n, slot) - slots;
+        occluder = scene.boundedObjects[indices[first + i]];
+        return true;
+      }
+    }
+    return false;
+  }
+
+ private:
+  const SceneAccelerator &scene;
+  int &occluder;
+};
+
+bool SceneAccelerator::Occluded(const Ray &ray, const Real tMax,
+                                TraversalStats *stats) const {
+  int occluder;
+  return Occluded(ray, tMax, occluder, stats);
+}
+
+bool SceneAccelerator::Occluded(const Ray &ray, const Real tMax,
+                                int &occluder, TraversalStats *stats) const {
+  // Planes first, they are few and often block the whole ray
+  for (unsigned index : unboundedObjects)
+    if (OccludeObject(index, ray, tMax)) {
+      occluder = index;
+      return true;
+    }
+
+  Ray boundedRay = ray;
+  boundedRay.tMax = tMax;
+  return accelerator->Occluded(boundedRay, AnyHit(*this, occluder), stats);
+}
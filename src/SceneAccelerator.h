@@ -0,0 +1,93 @@
+#pragma once
+#include <memory>
+#include <vector>
+#include "Accelerator.h"
+#include "Object.h"
+#include "SphereKernel.h"
+
+// Top level acceleration structure over the scene objects. Bounded objects
+// go into an accelerator (a BVH unless the settings ask otherwise),
+// unbounded ones (planes) are kept in a short list that every ray is tested
+// against.
+// Spheres, planes, disks and triangles are copied into flat arrays per type
+// when building, and queries run the type's intersection kernel on them
+// through a switch instead of a virtual call per object. Meshes and
+// instances still go through Object::Intersect. Leaves holding only spheres
+// are tested at once with the batched sphere kernel
+class SceneAccelerator : public PrimitiveIntersector {
+ public:
+  void Build(const std::vector<std::shared_ptr<Object>> &sceneObjects,
+             const Accelerator::Settings &settings = Accelerator::Settings());
+
+  // Updates the accelerator after objects moved or deformed. Rebuilds it
+  // instead if it can't be refitted or refits grew its SAH cost past
+  // Settings::maxRefitGrowth times the built one
+  void Refit();
+
+  // Closest hit, with hit.object the index of the object in the scene
+  // object list. False if the ray missed everything
+  bool Intersect(const Ray &ray, Hit &hit,
+                 TraversalStats *stats = nullptr) const;
+
+  // Closest hit on a single object, see Object::Intersect
+  bool IntersectObject(unsigned object, const Ray &ray, Hit &hit) const;
+  // Whether the object blocks the ray before tMax, see Object::Occluded
+  bool OccludeObject(unsigned object, const Ray &ray, const Real tMax) const;
+
+  // Whether any object blocks the ray before tMax, stops at the first one
+  bool Occluded(const Ray &ray, const Real tMax,
+                TraversalStats *stats = nullptr) const;
+  // Same, also gives the index of the blocking object (left as is if none)
+  bool Occluded(const Ray &ray, const Real tMax, int &occluder,
+                TraversalStats *stats = nullptr) const;
+
+  const Accelerator *GetAccelerator() const { return accelerator.get(); }
+  // Accelerator and object index lists, not the objects themselves
+  size_t GetMemoryUsage() const;
+
+  Real IntersectPrimitive(unsigned index, const Ray &ray) const;
+  bool OccludePrimitive(unsigned index, const Ray &ray) const;
+
+ private:
+  class ClosestHit;
+  class AnyHit;
+
+  enum PrimitiveType : unsigned char { SPHERE, PLANE, DISK, TRIANGLE, OBJECT };
+  // Where the data of an object is: slot in the array of its type, or in
+  // objects for OBJECT
+  struct PrimitiveRef {
+    PrimitiveType type;
+    unsigned slot;
+  };
+  struct PlaneData {
+    Vector3r center, normal;
+  };
+  struct DiskData {
+    Vector3r position, normal;
+    Real radius;
+  };
+  struct TriangleData {
+    Vector3r v0, v1, v2, normal;
+  };
+
+  // Fills refs and the per type arrays from objects
+  void GatherPrimitives();
+  // Builds a new accelerator over the bounded objects with settings
+  void BuildAccelerator(const std::vector<AABB> &objectBounds);
+  // Slots of the bounded objects indices[0..count) in spheres, false unless
+  // they are all spheres
+  bool GetSphereSlots(const unsigned *indices, const unsigned count,
+                      unsigned *slots) const;
+
+  std::vector<std::shared_ptr<Object>> objects;
+  std::vector<PrimitiveRef> refs;  // object index -> primitive
+  SphereArrays spheres;
+  std::vector<PlaneData> planes;
+  std::vector<DiskData> disks;
+  std::vector<TriangleData> triangles;
+  std::vector<unsigned> boundedObjects;    // BVH primitive -> object index
+  std::vector<unsigned> unboundedObjects;  // object indices
+  std::unique_ptr<Accelerator> accelerator;
+  Accelerator::Settings settings;
+  double builtSAHCost = 0;  // right after the last build, to track refits
+};
@@ -0,0 +1,96 @@
+#pragma once
+#include "Globals.h"
+
+// Reals one AVX2 register holds: 8 in single precision, 4 in double
+constexpr unsigned SIMD_LANES = 32 / sizeof(Real);
+
+#ifdef __AVX2__
+#include <immintrin.h>
+
+// The AVX2 operations the batched leaf kernels use, on registers of Real so
+// the same kernel code builds in either precision
+namespace simd {
+#ifdef TRACEY_SINGLE_PRECISION
+typedef __m256 Reals;
+
+inline Reals Set(const Real v) { return _mm256_set1_ps(v); }
+inline Reals Load(const Real *p) { return _mm256_loadu_ps(p); }
+inline Reals Gather(const Real *array, const unsigned lane[SIMD_LANES]) {
+  return _mm256_set_ps(array[lane[7]], array[lane[6]], array[lane[5]],
+                       array[lane[4]], array[lane[3]], array[lane[2]],
+                       array[lane[1]], array[lane[0]]);
+}
+inline void Store(Real *p, const Reals a) { _mm256_storeu_ps(p, a); }
+
+inline Reals Add(const Reals a, const Reals b) { return _mm256_add_ps(a, b); }
+inline Reals Sub(const Reals a, const Reals b) { return _mm256_sub_ps(a, b); }
+inline Reals Mul(const Reals a, const Reals b) { return _mm256_mul_ps(a, b); }
+inline Reals Div(const Reals a, const Reals b) { return _mm256_div_ps(a, b); }
+inline Reals Sqrt(const Reals a) { return _mm256_sqrt_ps(a); }
+inline Reals Negate(const Reals a) {
+  return _mm256_xor_ps(a, _mm256_set1_ps(-0.0f));
+}
+
+// Comparisons give all ones in the lanes where they hold
+inline Reals Less(const Reals a, const Reals b) {
+  return _mm256_cmp_ps(a, b, _CMP_LT_OQ);
+}
+inline Reals LessEqual(const Reals a, const Reals b) {
+  return _mm256_cmp_ps(a, b, _CMP_LE_OQ);
+}
+inline Reals Greater(const Reals a, const Reals b) {
+  return _mm256_cmp_ps(a, b, _CMP_GT_OQ);
+}
+inline Reals GreaterEqual(const Reals a, const Reals b) {
+  return _mm256_cmp_ps(a, b, _CMP_GE_OQ);
+}
+inline Reals And(const Reals a, const Reals b) { return _mm256_and_ps(a, b); }
+// b in the lanes set in mask, a in the others
+inline Reals Select(const Reals a, const Reals b, const Reals mask) {
+  return _mm256_blendv_ps(a, b, mask);
+}
+// One bit per lane, lane 0 in bit 0
+inline unsigned Mask(const Reals mask) { return _mm256_movemask_ps(mask); }
+#else
+typedef __m256d Reals;
+
+inline Reals Set(const Real v) { return _mm256_set1_pd(v); }
+inline Reals Load(const Real *p) { return _mm256_loadu_pd(p); }
+inline Reals Gather(const Real *array, const unsigned lane[SIMD_LANES]) {
+  return _mm256_set_pd(array[lane[3]], array[lane[2]], array[lane[1]],
+                       array[lane[0]]);
+}
+inline void Store(Real *p, const Reals a) { _mm256_storeu_pd(p, a); }
+
+inline Reals Add(const Reals a, const Reals b) { return _mm256_add_pd(a, b); }
+inline Reals Sub(const Reals a, const Reals b) { return _mm256_sub_pd(a, b); }
+inline Reals Mul(const Reals a, const Reals b) { return _mm256_mul_pd(a, b); }
+inline Reals Div(const Reals a, const Reals b) { return _mm256_div_pd(a, b); }
+inline Reals Sqrt(const Reals a) { return _mm256_sqrt_pd(a); }
+inline Reals Negate(const Reals a) {
+  return _mm256_xor_pd(a, _mm256_set1_pd(-0.0));
+}
+
+// Comparisons give all ones in the lanes where they hold
+inline Reals Less(const Reals a, const Reals b) {
+  return _mm256_cmp_pd(a, b, _CMP_LT_OQ);
+}
+inline Reals LessEqual(const Reals a, const Reals b) {
+  return _mm256_cmp_pd(a, b, _CMP_LE_OQ);
+}
+inline Reals Greater(const Reals a, const Reals b) {
+  return _mm256_cmp_pd(a, b, _CMP_GT_OQ);
+}
+inline Reals GreaterEqual(const Reals a, const Reals b) {
+  return _mm256_cmp_pd(a, b, _CMP_GE_OQ);
+}
+inline Reals And(const Reals a, const Reals b) { return _mm256_and_pd(a, b); }
+// b in the lanes set in mask, a in the others
+inline Reals Select(const Reals a, const Reals b, const Reals mask) {
+  return _mm256_blendv_pd(a, b, mask);
+}
+// One bit per lane, lane 0 in bit 0
+inline unsigned Mask(const Reals mask) { return _mm256_movemask_pd(mask); }
+#endif
+}  // namespace simd
+#endif
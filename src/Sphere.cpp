@@ -2,60 +2,70 @@
 
 Sphere::Sphere() {
   radius = 1;
-  center = Vector3d(1, 1, 1);
+  center = Vector3r(1, 1, 1);
 }
 
-Sphere::Sphere(double radius_, Vector3d center_) {
+Sphere::Sphere(Real radius_, Vector3r center_) {
   radius = radius_;
   center = center_;
 }
 
-Vector3d Sphere::GetNormalAt(const Vector3d &point) {
-  // normal always points away from the center of a sphere
-  return (point - center).Normalize();
+bool Sphere::Intersect(const Ray &ray, Hit &hit) const {
+  return Intersect(center, radius, ray, hit);
+}
+
+bool Sphere::Intersect(const Vector3r &center, const Real radius,
+                       const Ray &ray, Hit &hit) {
+  Real t = IntersectDistance(center, radius * radius, ray);
+  if (t <= BIAS || t >= ray.tMax) return false;
+  SetHit(center, ray, t, hit);
+  return true;
 }
 
-double Sphere::GetIntersection(const Ray &ray) {
-  Vector3d delta = ray.GetOrigin() - center;
-  Vector3d dir = ray.GetDirection();
+Real Sphere::IntersectDistance(const Vector3r &center, const Real radius2,
+                               const Ray &ray) {
+  Vector3r delta = ray.GetOrigin() - center;
+  Vector3r dir = ray.GetDirection();
 
   // Quadratic equation describing the distance along ray to intersection
-  double a = dir.Dot(dir);
-  double b = dir.Dot(delta);  // removed factor of 2 later divide by a, NOT 2a
-  double c = delta.Dot(delta) - radius * radius;
+  Real a = dir.Dot(dir);
+  Real b = dir.Dot(delta);  // removed factor of 2 later divide by a, NOT 2a
+  b = -b / a;  // distance to the point of the line closest to the center
 
-  double discriminant = b * b - a * c;
-  if (discriminant < double(0)) {
+  // The discriminant from that point, b * b - a * c cancels catastrophically
+  // for spheres small next to their distance, which single precision can't
+  // afford (Haines et al., "Precision Improvements for Ray/Sphere
+  // Intersection", Ray Tracing Gems)
+  Vector3r closest = delta + dir * b;
+  Real discriminant = (radius2 - closest.Dot(closest)) / a;
+  if (discriminant < Real(0)) {
     return -1;
   }
   // Find solutions to quadratic equation
-  discriminant = sqrt(discriminant) / a;
-  b = -b / a;
-
-  double intersection0 = b - discriminant;
-  if (intersection0 >= double(0)) {
-    return intersection0;
-  }
+  discriminant = sqrt(discriminant);
 
-  double intersection1 = b + discriminant;
-  if (intersection1 >= double(0)) {
-    return intersection1;
-  }
-
-  // Both solutions were negative
-  return -1;
+  // Nearest solution in front of the origin, even if it's too close to
+  // count (the ray leaving the sphere's surface)
+  Real t = b - discriminant;
+  if (t < Real(0)) t = b + discriminant;
+  return t;
 }
 
-Vector3d Sphere::GetTexCoords(Vector3d &normal, const Vector3d &hitPoint) {
-  normal = hitPoint - center;
-  normal.Normalize();
+void Sphere::SetHit(const Vector3r &center, const Ray &ray, const Real t,
+                    Hit &hit) {
+  hit.t = t;
+  // normal always points away from the center of a sphere
+  hit.normal = (ray.GetOrigin() + ray.GetDirection() * t - center).Normalize();
+  hit.geometricNormal = hit.normal;
+  hit.uv.x = (1 + atan2(hit.normal.z, hit.normal.x) / M_PI) * 0.5;
+  hit.uv.y = acos(hit.normal.y) / M_PI;
+}
 
-  Vector3d tex;
-  tex.x = (1 + atan2(normal.z, normal.x) / M_PI) * 0.5;
-  tex.y = acos(normal.y) / M_PI;
-  return tex;
+bool Sphere::GetBounds(AABB &bounds) const {
+  bounds = AABB(center - Vector3r(radius), center + Vector3r(radius));
+  return true;
 }
 
-double Sphere::GetRadius() const { return radius; }
+Real Sphere::GetRadius() const { return radius; }
 
-Vector3d Sphere::GetCenter() const { return center; }
+Vector3r Sphere::GetCenter() const { return center; }
@@ -5,15 +5,25 @@
 class Sphere : public Object {
  public:
   Sphere();
-  Sphere(double radius_, Vector3d center_);
+  Sphere(Real radius_, Vector3r center_);
 
-  Vector3d GetNormalAt(const Vector3d &point);
-  double GetIntersection(const Ray &ray);
-  double GetRadius() const;
-  Vector3d GetCenter() const;
-  Vector3d GetTexCoords(Vector3d &normal, const Vector3d &hitPoint);
+  bool Intersect(const Ray &ray, Hit &hit) const;
+  // Shared with the flat sphere arrays of SceneAccelerator
+  static bool Intersect(const Vector3r &center, const Real radius,
+                        const Ray &ray, Hit &hit);
+  // Nearest solution in front of the ray origin, ignoring tMax. Negative
+  // (or under BIAS) on a miss
+  static Real IntersectDistance(const Vector3r &center, const Real radius2,
+                                const Ray &ray);
+  // Fills the hit record for a hit at distance t
+  static void SetHit(const Vector3r &center, const Ray &ray, const Real t,
+                     Hit &hit);
+  Real GetRadius() const;
+  Vector3r GetCenter() const;
+  bool GetBounds(AABB &bounds) const;
+  size_t GetMemoryUsage() const { return sizeof(Sphere); }
 
  private:
-  double radius;
-  Vector3d center;
+  Real radius;
+  Vector3r center;
 };
@@ -0,0 +1,152 @@
+#include "SphereKernel.h"
+#include "Sphere.h"
+
+void SphereArrays::clear() {
+  for (unsigned axis = 0; axis < 3; axis++) center[axis].clear();
+  radius.clear();
+  radius2.clear();
+}
+
+void SphereArrays::push_back(const Vector3r &center_, const Real radius_) {
+  for (unsigned axis = 0; axis < 3; axis++)
+    center[axis].push_back(center_[axis]);
+  radius.push_back(radius_);
+  radius2.push_back(radius_ * radius_);
+}
+
+Real IntersectSpheresScalar(const SphereArrays &spheres,
+                            const unsigned *indices, const unsigned count,
+                            const Ray &ray, Real closest,
+                            unsigned &hitIndex) {
+  Real hit = -1;
+  for (unsigned i = 0; i < count; i++) {
+    const unsigned s = indices[i];
+    Real t = Sphere::IntersectDistance(spheres.GetCenter(s),
+                                       spheres.radius2[s], ray);
+    if (t > BIAS && t < closest) {
+      closest = hit = t;
+      hitIndex = s;
+    }
+  }
+  return hit;
+}
+
+bool OccludeSpheresScalar(const SphereArrays &spheres, const unsigned *indices,
+                          const unsigned count, const Ray &ray,
+                          unsigned &hitIndex) {
+  for (unsigned i = 0; i < count; i++) {
+    const unsigned s = indices[i];
+    Real t = Sphere::IntersectDistance(spheres.GetCenter(s),
+                                       spheres.radius2[s], ray);
+    if (t > BIAS && t < ray.tMax) {
+      hitIndex = s;
+      return true;
+    }
+  }
+  return false;
+}
+
+#ifdef __AVX2__
+namespace {
+using namespace simd;
+
+// Distances to SPHERE_LANES spheres from indices, with a bit set in the
+// returned mask for each one hit between BIAS and tMax. Same operations in
+// the same order as Sphere::IntersectDistance. Lanes past the end of the
+// list repeat its last sphere, which can't change the result. Sphere lists
+// come from scene leaves, which are never stored in order, so lanes are
+// always gathered
+inline unsigned IntersectLanes(const SphereArrays &spheres,
+                               const unsigned *indices, const unsigned count,
+                               const Ray &ray, const Real tMax,
+                               Real t[SPHERE_LANES]) {
+  unsigned lane[SPHERE_LANES];
+  for (unsigned i = 0; i < SPHERE_LANES; i++)
+    lane[i] = indices[std::min(i, count - 1)];
+
+  const Vector3r origin = ray.GetOrigin(), dir = ray.GetDirection();
+  Reals delta[3];
+  for (unsigned axis = 0; axis < 3; axis++)
+    delta[axis] =
+        Sub(Set(origin[axis]), Gather(spheres.center[axis].data(), lane));
+
+  // a is the same for every sphere
+  const Reals a = Set(dir.Dot(dir));
+  const Reals d[3] = {Set(dir.x), Set(dir.y), Set(dir.z)};
+  Reals b = Add(Add(Mul(d[0], delta[0]), Mul(d[1], delta[1])),
+                Mul(d[2], delta[2]));
+  b = Div(Negate(b), a);
+
+  Reals closest[3];
+  for (unsigned axis = 0; axis < 3; axis++)
+    closest[axis] = Add(delta[axis], Mul(d[axis], b));
+  Reals discriminant = Div(
+      Sub(Gather(spheres.radius2.data(), lane),
+          Add(Add(Mul(closest[0], closest[0]), Mul(closest[1], closest[1])),
+              Mul(closest[2], closest[2]))),
+      a);
+  const Reals zero = Set(0);
+  Reals valid = GreaterEqual(discriminant, zero);
+  discriminant = Sqrt(discriminant);
+
+  // Nearest solution in front of the origin, the far one if the near one is
+  // behind it
+  const Reals tNear = Sub(b, discriminant);
+  const Reals tFar = Add(b, discriminant);
+  const Reals dist = Select(tNear, tFar, Less(tNear, zero));
+  valid = And(valid, Greater(dist, Set(BIAS)));
+  valid = And(valid, Less(dist, Set(tMax)));
+
+  Store(t, dist);
+  return Mask(valid);
+}
+}  // namespace
+
+Real IntersectSpheres(const SphereArrays &spheres, const unsigned *indices,
+                      const unsigned count, const Ray &ray, Real closest,
+                      unsigned &hitIndex) {
+  Real hit = -1;
+  for (unsigned first = 0; first < count; first += SPHERE_LANES) {
+    Real t[SPHERE_LANES];
+    unsigned mask = IntersectLanes(spheres, indices + first, count - first,
+                                   ray, closest, t);
+    // In list order with a strict test, so ties go to the same sphere the
+    // scalar loop picks
+    while (mask) {
+      unsigned i = __builtin_ctz(mask);
+      mask &= mask - 1;
+      if (t[i] < closest) {
+        closest = hit = t[i];
+        hitIndex = indices[first + i];
+      }
+    }
+  }
+  return hit;
+}
+
+bool OccludeSpheres(const SphereArrays &spheres, const unsigned *indices,
+                    const unsigned count, const Ray &ray, unsigned &hitIndex) {
+  for (unsigned first = 0; first < count; first += SPHERE_LANES) {
+    Real t[SPHERE_LANES];
+    unsigned mask = IntersectLanes(spheres, indices + first, count - first,
+                                   ray, ray.tMax, t);
+    if (mask) {
+      hitIndex = indices[first + __builtin_ctz(mask)];
+      return true;
+    }
+  }
+  return false;
+}
+#else
+Real IntersectSpheres(const SphereArrays &spheres, const unsigned *indices,
+                      const unsigned count, const Ray &ray,
+                      const Real closest, unsigned &hitIndex) {
+  return IntersectSpheresScalar(spheres, indices, count, ray, closest,
+                                hitIndex);
+}
+
+bool OccludeSpheres(const SphereArrays &spheres, const unsigned *indices,
+                    const unsigned count, const Ray &ray, unsigned &hitIndex) {
+  return OccludeSpheresScalar(spheres, indices, count, ray, hitIndex);
+}
+#endif
@@ -0,0 +1,43 @@
+#pragma once
+#include <vector>
+#include "Ray.h"
+#include "SimdReal.h"
+
+// Spheres stored as one array per coordinate of the center, with the
+// squared radius the intersection test needs next to the radius
+struct SphereArrays {
+  std::vector<Real> center[3], radius, radius2;
+
+  unsigned size() const { return radius.size(); }
+  void clear();
+  void push_back(const Vector3r &center_, const Real radius_);
+  Vector3r GetCenter(const unsigned i) const {
+    return Vector3r(center[0][i], center[1][i], center[2][i]);
+  }
+  size_t GetMemoryUsage() const { return size() * 5 * sizeof(Real); }
+};
+
+// Spheres tested by one AVX2 instruction sequence, one per Real a register
+// holds
+constexpr unsigned SPHERE_LANES = SIMD_LANES;
+
+// Nearest hit between BIAS and closest of one ray with the spheres
+// indices[0..count). Returns its distance (-1 if there is none) and that
+// sphere in hitIndex. Same results as Sphere::Intersect on each of them,
+// SPHERE_LANES at a time when built with AVX2
+Real IntersectSpheres(const SphereArrays &spheres, const unsigned *indices,
+                      const unsigned count, const Ray &ray,
+                      const Real closest, unsigned &hitIndex);
+// Whether any of them is hit between BIAS and ray.tMax, hitIndex is the
+// first one found
+bool OccludeSpheres(const SphereArrays &spheres, const unsigned *indices,
+                    const unsigned count, const Ray &ray, unsigned &hitIndex);
+
+// One sphere at a time, used without AVX2 and as the benchmark reference
+Real IntersectSpheresScalar(const SphereArrays &spheres,
+                            const unsigned *indices, const unsigned count,
+                            const Ray &ray, const Real closest,
+                            unsigned &hitIndex);
+bool OccludeSpheresScalar(const SphereArrays &spheres, const unsigned *indices,
+                          const unsigned count, const Ray &ray,
+                          unsigned &hitIndex);
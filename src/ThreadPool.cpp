@@ -0,0 +1,163 @@
+#include "ThreadPool.h"
+#include <iostream>
+#include "Parallel.h"
+
+namespace {
+thread_local const ThreadPool *currentPool = nullptr;
+thread_local unsigned currentWorker = 0;
+}  // namespace
+
+ThreadPool::ThreadPool(const unsigned workers, const ThreadAffinity affinity_)
+    : affinity{affinity_} {
+  for (unsigned i = 0; i < std::max(workers, 1u); i++)
+    queues.emplace_back(new Queue);
+
+  workerNodes.assign(queues.size(), 0);
+  if (affinity != ThreadAffinity::None) {
+    topology = NumaTopology::Read(NUMA_NODE_DIRECTORY);
+    nodeCount = 0;
+    for (unsigned i = 0; i < queues.size(); i++) {
+      topology.WorkerCpu(i, affinity, workerNodes[i]);
+      nodeCount = std::max(nodeCount, workerNodes[i] + 1);
+    }
+    Pin(WorkerCount() - 1);
+  }
+
+  threads.reserve(queues.size() - 1);
+  for (unsigned i = 0; i + 1 < queues.size(); i++)
+    threads.emplace_back(&ThreadPool::WorkerLoop, this, i);
+}
+
+ThreadPool::~ThreadPool() { Shutdown(); }
+
+unsigned ThreadPool::CurrentWorker() const {
+  return currentPool == this ? currentWorker : WorkerCount() - 1;
+}
+
+void ThreadPool::Submit(TaskGroup &group, std::function<void()> task) {
+  group.pending++;
+  Queue &queue = *queues[CurrentWorker()];
+  {
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    queue.tasks.push_back({std::move(task), &group});
+    // Counted before another thread can take it, so queued never wraps
+    // below zero when RunOne takes the task and decrements it
+    queued++;
+  }
+  // Taking the lock orders this with a sleeper checking queued
+  { std::lock_guard<std::mutex> lock(sleepMutex); }
+  wake.notify_one();
+}
+
+void ThreadPool::SubmitTo(const unsigned worker, TaskGroup &group,
+                          std::function<void()> task) {
+  group.pending++;
+  // Once shut down only the waiting thread is left to run it
+  Queue &queue = *queues[threads.empty() ? WorkerCount() - 1 : worker];
+  {
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    queue.pinned.push_back({std::move(task), &group});
+    queue.pinnedCount++;
+  }
+  // Only that worker can run it, so wake everyone to be sure it wakes
+  { std::lock_guard<std::mutex> lock(sleepMutex); }
+  wake.notify_all();
+}
+
+void ThreadPool::Wait(TaskGroup &group) {
+  const unsigned worker = CurrentWorker();
+  const Queue &own = *queues[worker];
+  while (group.pending) {
+    if (RunOne(worker)) continue;
+    std::unique_lock<std::mutex> lock(sleepMutex);
+    wake.wait(lock,
+              [&] { return queued || own.pinnedCount || !group.pending; });
+  }
+}
+
+void ThreadPool::Shutdown() {
+  {
+    std::lock_guard<std::mutex> lock(sleepMutex);
+    stopping = true;
+  }
+  wake.notify_all();
+  for (auto &thread : threads) thread.join();
+  threads.clear();
+}
+
+bool ThreadPool::RunOne(const unsigned worker) {
+  Task task;
+  bool found = false;
+  Queue &own = *queues[worker];
+  if (own.pinnedCount) {
+    std::lock_guard<std::mutex> lock(own.mutex);
+    if (!own.pinned.empty()) {
+      task = std::move(own.pinned.front());
+      own.pinned.pop_front();
+      own.pinnedCount--;
+      found = true;
+    }
+  }
+  for (unsigned i = 0; i < queues.size() && !found; i++) {
+    Queue &queue = *queues[(worker + i) % queues.size()];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (queue.tasks.empty()) continue;
+    if (i == 0) {
+      task = std::move(queue.tasks.back());
+      queue.tasks.pop_back();
+    } else {
+      task = std::move(queue.tasks.front());
+      queue.tasks.pop_front();
+    }
+    queued--;
+    found = true;
+  }
+  if (!found) return false;
+
+  task.func();
+  if (--task.group->pending == 0) {
+    { std::lock_guard<std::mutex> lock(sleepMutex); }
+    wake.notify_all();
+  }
+  return true;
+}
+
+void ThreadPool::Pin(const unsigned worker) {
+  unsigned node;
+  unsigned cpu = topology.WorkerCpu(worker, affinity, node);
+  if (!PinThread(cpu))
+    std::cerr << "Couldn't pin worker " << worker << " to CPU " << cpu
+              << std::endl;
+}
+
+void ThreadPool::WorkerLoop(const unsigned worker) {
+  currentPool = this;
+  currentWorker = worker;
+  // Before the worker allocates anything, so its memory is on its node
+  if (affinity != ThreadAffinity::None) Pin(worker);
+
+  const Queue &own = *queues[worker];
+  while (true) {
+    if (RunOne(worker)) continue;
+    std::unique_lock<std::mutex> lock(sleepMutex);
+    wake.wait(lock, [&] { return queued || own.pinnedCount || stopping; });
+    if (!queued && !own.pinnedCount && stopping) return;
+  }
+}
+
+namespace {
+std::unique_ptr<ThreadPool> globalPool;
+std::mutex globalPoolMutex;
+}  // namespace
+
+ThreadPool &GlobalPool() {
+  std::lock_guard<std::mutex> lock(globalPoolMutex);
+  if (!globalPool)
+    globalPool.reset(new ThreadPool(ThreadCount(), THREAD_AFFINITY));
+  return *globalPool;
+}
+
+void ShutdownGlobalPool() {
+  std::lock_guard<std::mutex> lock(globalPoolMutex);
+  globalPool.reset();
+}
@@ -0,0 +1,86 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "Numa.h"
+
+// Tasks submitted to a ThreadPool that are waited on together
+class TaskGroup {
+  friend class ThreadPool;
+  std::atomic<unsigned> pending{0};
+};
+
+// Worker threads started once and shared by scene setup, acceleration
+// structure builds and rendering. Each worker has its own deque, it pushes
+// and pops its tasks at the back while idle workers steal from the front of
+// the others. A thread waiting on a group runs queued tasks until the group
+// is done, so tasks can submit and wait on tasks of their own
+class ThreadPool {
+ public:
+  // workers counts the threads running tasks including the one waiting on
+  // them, so workers - 1 threads are started. Unless affinity is None every
+  // worker is pinned to a CPU, the thread creating the pool included
+  explicit ThreadPool(const unsigned workers,
+                      const ThreadAffinity affinity = ThreadAffinity::None);
+  ~ThreadPool();
+
+  unsigned WorkerCount() const { return unsigned(queues.size()); }
+  // Index of the calling thread in [0, WorkerCount()), threads outside the
+  // pool share the last one
+  unsigned CurrentWorker() const;
+  // NUMA node the worker is pinned to, all are on node 0 when unpinned
+  unsigned WorkerNode(const unsigned worker) const {
+    return workerNodes[worker];
+  }
+  unsigned NodeCount() const { return nodeCount; }
+
+  void Submit(TaskGroup &group, std::function<void()> task);
+  // Runs the task on that worker, it is never stolen by another
+  void SubmitTo(const unsigned worker, TaskGroup &group,
+                std::function<void()> task);
+  void Wait(TaskGroup &group);
+
+  // Runs the tasks still queued and joins the workers. Groups submitted
+  // afterwards run on the thread waiting on them
+  void Shutdown();
+
+ private:
+  struct Task {
+    std::function<void()> func;
+    TaskGroup *group;
+  };
+  struct Queue {
+    std::mutex mutex;
+    std::deque<Task> tasks;
+    std::deque<Task> pinned;  // see SubmitTo
+    std::atomic<unsigned> pinnedCount{0};
+  };
+
+  // Pops a task of worker's own queues or steals one, false if all are empty
+  bool RunOne(const unsigned worker);
+  void Pin(const unsigned worker);
+  void WorkerLoop(const unsigned worker);
+
+  std::vector<std::unique_ptr<Queue>> queues;
+  std::vector<std::thread> threads;
+  ThreadAffinity affinity;
+  NumaTopology topology;
+  std::vector<unsigned> workerNodes;
+  unsigned nodeCount = 1;
+  std::atomic<unsigned> queued{0};
+  // Sleeping workers and waiters are woken when tasks are queued, a group
+  // finishes or the pool shuts down
+  std::mutex sleepMutex;
+  std::condition_variable wake;
+  bool stopping = false;
+};
+
+// Pool shared by the whole program, started with ThreadCount() workers on
+// first use
+ThreadPool &GlobalPool();
+void ShutdownGlobalPool();
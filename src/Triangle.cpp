@@ -1,40 +1,70 @@
 #include "Triangle.h"
 
 Triangle::Triangle() {
-  v0 = Vector3d(0, 0, 6);
-  v1 = Vector3d(1, 0, 6);
-  v2 = Vector3d(1, 1, 6);
+  v0 = Vector3r(0, 0, 6);
+  v1 = Vector3r(1, 0, 6);
+  v2 = Vector3r(1, 1, 6);
   normal = (v1 - v0).Cross(v2 - v0).Normalize();
 }
 
-Triangle::Triangle(Vector3d &v0_, Vector3d &v1_, Vector3d &v2_)
+Triangle::Triangle(Vector3r &v0_, Vector3r &v1_, Vector3r &v2_)
     : v0{v0_}, v1{v1_}, v2{v2_}, normal{(v1 - v0).Cross(v2 - v0).Normalize()} {}
 
-Vector3d Triangle::GetNormalAt(const Vector3d &) {
-  return normal;  // Has to be inverted for some reason
+bool Triangle::Intersect(const Ray &ray, Hit &hit) const {
+  return Intersect(v0, v1, v2, normal, ray, hit);
 }
 
-double Triangle::GetIntersection(const Ray &ray, double &u, double &v) {
-  Vec3d v0v1 = v1 - v0;
-  Vec3d v0v2 = v2 - v0;
-  Vec3d pvec = ray.GetDirection().Cross(v0v2);
-  double det = v0v1.Dot(pvec);
+bool Triangle::Intersect(const Vector3r &v0, const Vector3r &v1,
+                         const Vector3r &v2, const Vector3r &normal,
+                         const Ray &ray, Hit &hit) {
+  Real u, v;
+  Real t = Intersect(v0, v1, v2, ray, u, v);
+  if (t <= BIAS || t >= ray.tMax) return false;
+
+  hit.t = t;
+  hit.u = u;
+  hit.v = v;
+  hit.normal = hit.geometricNormal = normal;
+  return true;
+}
+
+bool Triangle::GetBounds(AABB &bounds) const {
+  bounds = AABB();
+  bounds.Expand(v0);
+  bounds.Expand(v1);
+  bounds.Expand(v2);
+  return true;
+}
+
+// Moller-Trumbore, shared with TriangleMesh so it doesn't have to build a
+// Triangle object per face
+Real Triangle::Intersect(const Vector3r &v0, const Vector3r &v1,
+                         const Vector3r &v2, const Ray &ray, Real &u,
+                         Real &v) {
+  return IntersectEdges(v0, v1 - v0, v2 - v0, ray, u, v);
+}
+
+Real Triangle::IntersectEdges(const Vector3r &v0, const Vector3r &v0v1,
+                              const Vector3r &v0v2, const Ray &ray,
+                              Real &u, Real &v) {
+  Vector3r pvec = ray.GetDirection().Cross(v0v2);
+  Real det = v0v1.Dot(pvec);
 
   if (det < BIAS) return false;
   // ray and triangle are parallel if det is close to 0
   if (std::fabs(det) < BIAS) return false;
 
-  double invDet = 1 / det;
+  Real invDet = 1 / det;
 
-  Vec3d tvec = ray.GetOrigin() - v0;
+  Vector3r tvec = ray.GetOrigin() - v0;
   u = tvec.Dot(pvec) * invDet;
   if (u < 0 || u > 1) return false;
 
-  Vec3d qvec = tvec.Cross(v0v1);
+  Vector3r qvec = tvec.Cross(v0v1);
   v = ray.GetDirection().Dot(qvec) * invDet;
   if (v < 0 || u + v > 1) return false;
 
-  double t = v0v2.Dot(qvec) * invDet;
+  Real t = v0v2.Dot(qvec) * invDet;
 
   return (t > BIAS) ? t : false;
 }
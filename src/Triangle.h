@@ -7,13 +7,25 @@
 class Triangle : public Object {
  public:
   Triangle();
-  Triangle(Vector3d &v0_, Vector3d &v1_, Vector3d &v2_);
+  Triangle(Vector3r &v0_, Vector3r &v1_, Vector3r &v2_);
 
-  Vector3d GetNormalAt(const Vector3d &point);
-  double GetIntersection(const Ray &ray, double &u, double &v);
+  bool Intersect(const Ray &ray, Hit &hit) const;
+  bool GetBounds(AABB &bounds) const;
+  static Real Intersect(const Vector3r &v0, const Vector3r &v1,
+                        const Vector3r &v2, const Ray &ray, Real &u,
+                        Real &v);
+  // Same with the edges v1 - v0 and v2 - v0 precomputed
+  static Real IntersectEdges(const Vector3r &v0, const Vector3r &edge1,
+                             const Vector3r &edge2, const Ray &ray,
+                             Real &u, Real &v);
+  // Shared with the flat triangle array of SceneAccelerator
+  static bool Intersect(const Vector3r &v0, const Vector3r &v1,
+                        const Vector3r &v2, const Vector3r &normal,
+                        const Ray &ray, Hit &hit);
+  Vector3r GetNormal() const { return normal; }
 
-  Vector3d v0, v1, v2;
+  Vector3r v0, v1, v2;
 
  private:
-  Vector3d normal;
+  Vector3r normal;
 };
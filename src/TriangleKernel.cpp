@@ -0,0 +1,224 @@
+#include "TriangleKernel.h"
+#include "Triangle.h"
+
+void TriangleArrays::resize(const unsigned count) {
+  for (unsigned axis = 0; axis < 3; axis++) {
+    v0[axis].resize(count);
+    edge1[axis].resize(count);
+    edge2[axis].resize(count);
+  }
+}
+
+TriangleArrayView::TriangleArrayView(const TriangleArrays &arrays) {
+  for (unsigned axis = 0; axis < 3; axis++) {
+    v0[axis] = arrays.v0[axis];
+    edge1[axis] = arrays.edge1[axis];
+    edge2[axis] = arrays.edge2[axis];
+  }
+}
+
+std::vector<DataBlock> TriangleArrayView::ToBlocks() const {
+  std::vector<DataBlock> blocks;
+  for (const ArrayView<Real> *arrays : {v0, edge1, edge2})
+    for (unsigned axis = 0; axis < 3; axis++)
+      blocks.emplace_back(arrays[axis].ToBlock());
+  return blocks;
+}
+
+bool TriangleArrayView::FromBlocks(const std::vector<DataBlock> &blocks,
+                                   const unsigned count) {
+  if (blocks.size() != 9) return false;
+  unsigned block = 0;
+  for (ArrayView<Real> *arrays : {v0, edge1, edge2})
+    for (unsigned axis = 0; axis < 3; axis++, block++)
+      if (!arrays[axis].FromBlock(blocks[block]) ||
+          arrays[axis].size != count)
+        return false;
+  return true;
+}
+
+void TriangleArrayView::CopyTo(TriangleArrays &storage) const {
+  for (unsigned axis = 0; axis < 3; axis++) {
+    storage.v0[axis].assign(v0[axis].begin(), v0[axis].end());
+    storage.edge1[axis].assign(edge1[axis].begin(), edge1[axis].end());
+    storage.edge2[axis].assign(edge2[axis].begin(), edge2[axis].end());
+  }
+}
+
+namespace {
+inline Real IntersectOne(const TriangleArrayView &tris, const unsigned i,
+                         const Ray &ray) {
+  Real u, v;
+  return Triangle::IntersectEdges(
+      Vector3r(tris.v0[0][i], tris.v0[1][i], tris.v0[2][i]),
+      Vector3r(tris.edge1[0][i], tris.edge1[1][i], tris.edge1[2][i]),
+      Vector3r(tris.edge2[0][i], tris.edge2[1][i], tris.edge2[2][i]), ray, u,
+      v);
+}
+}  // namespace
+
+Real IntersectTrianglesScalar(const TriangleArrayView &triangles,
+                              const unsigned *indices, const unsigned count,
+                              const Ray &ray, Real closest,
+                              unsigned &hitIndex) {
+  Real hit = -1;
+  for (unsigned i = 0; i < count; i++) {
+    Real t = IntersectOne(triangles, indices[i], ray);
+    if (t > BIAS && t < closest) {
+      closest = hit = t;
+      hitIndex = indices[i];
+    }
+  }
+  return hit;
+}
+
+bool OccludeTrianglesScalar(const TriangleArrayView &triangles,
+                            const unsigned *indices, const unsigned count,
+                            const Ray &ray) {
+  for (unsigned i = 0; i < count; i++) {
+    Real t = IntersectOne(triangles, indices[i], ray);
+    if (t > BIAS && t < ray.tMax) return true;
+  }
+  return false;
+}
+
+#ifdef __AVX2__
+namespace {
+using namespace simd;
+
+// The ray broadcast to every lane
+struct RayLanes {
+  Reals origin[3], direction[3];
+
+  explicit RayLanes(const Ray &ray) {
+    const Vector3r o = ray.GetOrigin(), d = ray.GetDirection();
+    for (unsigned axis = 0; axis < 3; axis++) {
+      origin[axis] = Set(o[axis]);
+      direction[axis] = Set(d[axis]);
+    }
+  }
+};
+
+// Leaves reordered with their faces (ReorderPrimitives) reference
+// consecutive triangles, which load straight from the arrays. Others
+// (duplicated references, kd-tree leaves) are gathered lane by lane. Lanes
+// past the end of the leaf repeat its last triangle, which can't change the
+// result
+inline Reals Load(const ArrayView<Real> &array, const unsigned *lane,
+                  const bool contiguous) {
+  if (contiguous) return simd::Load(&array[lane[0]]);
+  return Gather(array.data, lane);
+}
+
+inline Reals Cross(const Reals a0, const Reals a1, const Reals b0,
+                   const Reals b1) {
+  return Sub(Mul(a0, b1), Mul(a1, b0));
+}
+
+inline Reals Dot(const Reals a[3], const Reals b[3]) {
+  return Add(Add(Mul(a[0], b[0]), Mul(a[1], b[1])), Mul(a[2], b[2]));
+}
+
+// Distances of TRIANGLE_LANES triangles from indices, with a bit set in
+// the returned mask for each one hit between BIAS and tMax. Same operations
+// in the same order as Triangle::IntersectEdges
+inline unsigned IntersectLanes(const TriangleArrayView &tris,
+                               const unsigned *indices, const unsigned count,
+                               const RayLanes &ray, const Real tMax,
+                               Real t[TRIANGLE_LANES]) {
+  unsigned lane[TRIANGLE_LANES];
+  bool contiguous = count >= TRIANGLE_LANES;
+  for (unsigned i = 0; i < TRIANGLE_LANES; i++) {
+    lane[i] = indices[std::min(i, count - 1)];
+    contiguous &= lane[i] == lane[0] + i;
+  }
+
+  Reals v0[3], e1[3], e2[3];
+  for (unsigned axis = 0; axis < 3; axis++) {
+    v0[axis] = Load(tris.v0[axis], lane, contiguous);
+    e1[axis] = Load(tris.edge1[axis], lane, contiguous);
+    e2[axis] = Load(tris.edge2[axis], lane, contiguous);
+  }
+
+  const Reals *d = ray.direction;
+  const Reals pvec[3] = {Cross(d[1], d[2], e2[1], e2[2]),
+                         Cross(d[2], d[0], e2[2], e2[0]),
+                         Cross(d[0], d[1], e2[0], e2[1])};
+  const Reals det = Dot(e1, pvec);
+  const Reals bias = Set(BIAS);
+  Reals valid = GreaterEqual(det, bias);
+  const Reals invDet = Div(Set(1), det);
+
+  const Reals tvec[3] = {Sub(ray.origin[0], v0[0]), Sub(ray.origin[1], v0[1]),
+                         Sub(ray.origin[2], v0[2])};
+  const Reals u = Mul(Dot(tvec, pvec), invDet);
+  const Reals zero = Set(0), one = Set(1);
+  valid = And(valid, GreaterEqual(u, zero));
+  valid = And(valid, LessEqual(u, one));
+
+  const Reals qvec[3] = {Cross(tvec[1], tvec[2], e1[1], e1[2]),
+                         Cross(tvec[2], tvec[0], e1[2], e1[0]),
+                         Cross(tvec[0], tvec[1], e1[0], e1[1])};
+  const Reals v = Mul(Dot(d, qvec), invDet);
+  valid = And(valid, GreaterEqual(v, zero));
+  valid = And(valid, LessEqual(Add(u, v), one));
+
+  const Reals dist = Mul(Dot(e2, qvec), invDet);
+  valid = And(valid, Greater(dist, bias));
+  valid = And(valid, Less(dist, Set(tMax)));
+
+  Store(t, dist);
+  return Mask(valid);
+}
+}  // namespace
+
+Real IntersectTriangles(const TriangleArrayView &triangles,
+                        const unsigned *indices, const unsigned count,
+                        const Ray &ray, Real closest, unsigned &hitIndex) {
+  const RayLanes rayLanes(ray);
+  Real hit = -1;
+  for (unsigned first = 0; first < count; first += TRIANGLE_LANES) {
+    Real t[TRIANGLE_LANES];
+    unsigned mask = IntersectLanes(triangles, indices + first, count - first,
+                                   rayLanes, closest, t);
+    // In index order with a strict test, so ties go to the same triangle
+    // the scalar loop picks
+    while (mask) {
+      unsigned i = __builtin_ctz(mask);
+      mask &= mask - 1;
+      if (t[i] < closest) {
+        closest = hit = t[i];
+        hitIndex = indices[first + i];
+      }
+    }
+  }
+  return hit;
+}
+
+bool OccludeTriangles(const TriangleArrayView &triangles,
+                      const unsigned *indices, const unsigned count,
+                      const Ray &ray) {
+  const RayLanes rayLanes(ray);
+  for (unsigned first = 0; first < count; first += TRIANGLE_LANES) {
+    Real t[TRIANGLE_LANES];
+    if (IntersectLanes(triangles, indices + first, count - first, rayLanes,
+                       ray.tMax, t))
+      return true;
+  }
+  return false;
+}
+#else
+Real IntersectTriangles(const TriangleArrayView &triangles,
+                        const unsigned *indices, const unsigned count,
+                        const Ray &ray, const Real closest,
+                        unsigned &hitIndex) {
+  return IntersectTrianglesScalar(triangles, indices, count, ray, closest,
+                                  hitIndex);
+}
+
+bool OccludeTriangles(const TriangleArrayView &triangles,
+                      const unsigned *indices, const unsigned count,
+                      const Ray &ray) {
+  return OccludeTrianglesScalar(triangles, indices, count, ray);
+}
+#endif
@@ -0,0 +1,60 @@
+#pragma once
+#include <vector>
+#include "Accelerator.h"
+#include "Ray.h"
+#include "SimdReal.h"
+
+// Triangles stored as one array per coordinate of the first vertex and of
+// the edges v1 - v0 and v2 - v0, the layout the batched kernels load from
+struct TriangleArrays {
+  std::vector<Real> v0[3], edge1[3], edge2[3];
+
+  unsigned size() const { return v0[0].size(); }
+  void resize(const unsigned count);
+  size_t GetMemoryUsage() const { return size() * 9 * sizeof(Real); }
+};
+
+// What the kernels read: the arrays of a TriangleArrays or the same arrays
+// mapped from a mesh cache file
+struct TriangleArrayView {
+  ArrayView<Real> v0[3], edge1[3], edge2[3];
+
+  TriangleArrayView() {}
+  TriangleArrayView(const TriangleArrays &arrays);
+
+  unsigned size() const { return v0[0].size; }
+  size_t GetMemoryUsage() const { return size() * 9 * sizeof(Real); }
+  // v0, edge1 then edge2, each by axis
+  std::vector<DataBlock> ToBlocks() const;
+  // False unless blocks are nine arrays of count Reals
+  bool FromBlocks(const std::vector<DataBlock> &blocks, const unsigned count);
+  // Copies the arrays into storage
+  void CopyTo(TriangleArrays &storage) const;
+};
+
+// Triangles tested by one AVX2 instruction sequence, one per Real a register
+// holds
+constexpr unsigned TRIANGLE_LANES = SIMD_LANES;
+
+// Moller-Trumbore between one ray and the triangles indices[0..count), a
+// leaf. Returns the closest distance between BIAS and closest (-1 if there
+// is none) and that triangle in hitIndex. Same results as
+// Triangle::IntersectEdges on each of them, TRIANGLE_LANES at a time when
+// built with AVX2
+Real IntersectTriangles(const TriangleArrayView &triangles,
+                        const unsigned *indices, const unsigned count,
+                        const Ray &ray, const Real closest,
+                        unsigned &hitIndex);
+// Whether any of them is hit between BIAS and ray.tMax
+bool OccludeTriangles(const TriangleArrayView &triangles,
+                      const unsigned *indices, const unsigned count,
+                      const Ray &ray);
+
+// One triangle at a time, used without AVX2 and as the benchmark reference
+Real IntersectTrianglesScalar(const TriangleArrayView &triangles,
+                              const unsigned *indices, const unsigned count,
+                              const Ray &ray, const Real closest,
+                              unsigned &hitIndex);
+bool OccludeTrianglesScalar(const TriangleArrayView &triangles,
+                            const unsigned *indices, const unsigned count,
+                            const Ray &ray);
@@ -1,6 +1,17 @@
 #include "TriangleMesh.h"
+#include <chrono>
+#include "Parallel.h"
+
+TriangleMesh::TriangleMesh(const char *file,
+                           const Accelerator::Settings &settings_)
+    : settings{settings_} {
+  std::string cachePath;
+  uint64_t hash;
+  if (MESH_CACHE_DIRECTORY[0] && HashFile(file, hash)) {
+    cachePath = GetMeshCachePath(hash, settings);
+    if (LoadCache(cachePath)) return;
+  }
 
-TriangleMesh::TriangleMesh(const char *file) {
   std::string inputfile = file;
   bool ret =
       tinyobj::LoadObj(&attrib, &shapes, &materials, &err, inputfile.c_str());
@@ -10,58 +21,325 @@ TriangleMesh::TriangleMesh(const char *file) {
   if (!ret || !attrib.normals.size()) exit(1);
 
   std::cout << "Model vertices: " << attrib.vertices.size() << std::endl;
-}
 
-double TriangleMesh::GetIntersection(const Ray &ray) {
-  double distLowest = 1000000, intersection;
-  bool polygon_hit = false;
-  for (auto &shape : shapes) {
+  // Gather the faces of all shapes so the BVH can index them directly
+  for (const auto &shape : shapes) {
     size_t index_offset = 0;
-    for (size_t f = 0; f < shape.mesh.num_face_vertices.size();
-         ++f)  // faces (triangles)
-    {
-      int fv = shape.mesh.num_face_vertices[f];
-      tinyobj::index_t &idx0 = shape.mesh.indices[index_offset + 0];  // v0
-      tinyobj::index_t &idx1 = shape.mesh.indices[index_offset + 1];  // v1
-      tinyobj::index_t &idx2 = shape.mesh.indices[index_offset + 2];  // v2
-
-      // Vertices;
-      tri.v0 = Vec3d(attrib.vertices[3 * idx0.vertex_index + 0],
-                     attrib.vertices[3 * idx0.vertex_index + 1],
-                     attrib.vertices[3 * idx0.vertex_index + 2]);
-      tri.v1 = Vec3d(attrib.vertices[3 * idx1.vertex_index + 0],
-                     attrib.vertices[3 * idx1.vertex_index + 1],
-                     attrib.vertices[3 * idx1.vertex_index + 2]);
-      tri.v2 = Vec3d(attrib.vertices[3 * idx2.vertex_index + 0],
-                     attrib.vertices[3 * idx2.vertex_index + 1],
-                     attrib.vertices[3 * idx2.vertex_index + 2]);
-
-      // Vertex normals
-      n0 = Vec3d(attrib.normals[3 * idx0.normal_index + 0],
-                 attrib.normals[3 * idx0.normal_index + 1],
-                 attrib.normals[3 * idx0.normal_index + 2]);
-      n1 = Vec3d(attrib.normals[3 * idx1.normal_index + 0],
-                 attrib.normals[3 * idx1.normal_index + 1],
-                 attrib.normals[3 * idx1.normal_index + 2]);
-      n2 = Vec3d(attrib.normals[3 * idx2.normal_index + 0],
-                 attrib.normals[3 * idx2.normal_index + 1],
-                 attrib.normals[3 * idx2.normal_index + 2]);
-
-      intersection = tri.GetIntersection(ray, uv.x, uv.y);
-      if (intersection && intersection < distLowest) {
-        polygon_hit = true;
-        distLowest = intersection;
-        normal = n0 * (1 - uv.x - uv.y) + n1 * uv.x + n2 * uv.y;
+    for (size_t f = 0; f < shape.mesh.num_face_vertices.size(); ++f) {
+      faces.emplace_back(shape.mesh.indices[index_offset + 0]);  // v0
+      faces.emplace_back(shape.mesh.indices[index_offset + 1]);  // v1
+      faces.emplace_back(shape.mesh.indices[index_offset + 2]);  // v2
+      index_offset += shape.mesh.num_face_vertices[f];
+    }
+  }
+
+  vertexView = attrib.vertices;
+  normalView = attrib.normals;
+  faceView = faces;
+
+  std::cout << "Model triangles: " << GetFaceCount() << std::endl;
+  BuildAccelerator(settings);
+  if (!cachePath.empty()) SaveCache(cachePath);
+}
+
+bool TriangleMesh::LoadCache(const std::string &path) {
+  auto timeStart = std::chrono::high_resolution_clock::now();
+  std::vector<DataBlock> blocks;
+  std::unique_ptr<MappedFile> mapping = ReadMeshCache(path, blocks);
+  // Vertices, normals and faces, then the kernel arrays and face normals
+  // (see SaveCache), then the accelerator's
+  if (!mapping || blocks.size() < 13) return false;
+
+  ArrayView<tinyobj::real_t> vertices, normals;
+  ArrayView<tinyobj::index_t> indices;
+  TriangleArrayView triangles;
+  ArrayView<Vector3r> triangleNormals;
+  std::unique_ptr<Accelerator> cached = Accelerator::Create(settings);
+  if (!vertices.FromBlock(blocks[0]) || !normals.FromBlock(blocks[1]) ||
+      !indices.FromBlock(blocks[2]) || indices.size % 3 ||
+      !triangles.FromBlocks({blocks.begin() + 3, blocks.begin() + 12},
+                            indices.size / 3) ||
+      !triangleNormals.FromBlock(blocks[12]) ||
+      triangleNormals.size != indices.size)
+    return false;
+  // Faces must only reference vertices and normals the file holds
+  for (const tinyobj::index_t &index : indices)
+    if (index.vertex_index < 0 || index.normal_index < 0 ||
+        size_t(index.vertex_index) >= vertices.size / 3 ||
+        size_t(index.normal_index) >= normals.size / 3)
+      return false;
+  if (!cached->SetArrays({blocks.begin() + 13, blocks.end()},
+                         indices.size / 3))
+    return false;
+
+  vertexView = vertices;
+  normalView = normals;
+  faceView = indices;
+  faceArrayView = triangles;
+  faceNormalView = triangleNormals;
+  accelerator = std::move(cached);
+  builtSAHCost = accelerator->GetSAHCost();
+  cacheFile = std::move(mapping);
+  auto timeEnd = std::chrono::high_resolution_clock::now();
+
+  std::cout << "Model triangles: " << GetFaceCount() << std::endl;
+  std::cout << accelerator->GetName() << ": "
+            << accelerator->GetMemoryUsage() / 1024 << " KB, loaded from "
+            << path << " in "
+            << std::chrono::duration<double, std::milli>(timeEnd - timeStart)
+                   .count()
+            << " ms" << std::endl;
+  return true;
+}
+
+void TriangleMesh::SaveCache(const std::string &path) const {
+  // Accelerators without arrays (grids) are cheap to build anyway
+  std::vector<DataBlock> arrays = accelerator->GetArrays();
+  if (arrays.empty()) return;
+
+  // Kernel arrays and face normals too, so loading maps every array the
+  // renderer reads instead of recomputing them
+  std::vector<DataBlock> blocks = {vertexView.ToBlock(), normalView.ToBlock(),
+                                   faceView.ToBlock()};
+  std::vector<DataBlock> triangles = faceArrayView.ToBlocks();
+  blocks.insert(blocks.end(), triangles.begin(), triangles.end());
+  blocks.emplace_back(faceNormalView.ToBlock());
+  blocks.insert(blocks.end(), arrays.begin(), arrays.end());
+  if (!WriteMeshCache(path, blocks))
+    std::cerr << "Could not write the mesh cache " << path << std::endl;
+}
+
+void TriangleMesh::DetachCache() {
+  if (!cacheFile) return;
+  attrib.vertices.assign(vertexView.begin(), vertexView.end());
+  attrib.normals.assign(normalView.begin(), normalView.end());
+  faces.assign(faceView.begin(), faceView.end());
+  faceArrayView.CopyTo(faceArrays);
+  faceNormals.assign(faceNormalView.begin(), faceNormalView.end());
+  vertexView = attrib.vertices;
+  normalView = attrib.normals;
+  faceView = faces;
+  faceArrayView = faceArrays;
+  faceNormalView = faceNormals;
+}
+
+std::vector<AABB> TriangleMesh::GetFaceBounds() const {
+  std::vector<AABB> faceBounds(GetFaceCount());
+  ParallelFor(faceBounds.size(), ThreadCount(),
+              [&](size_t begin, size_t end, unsigned) {
+                for (size_t f = begin; f < end; f++) {
+                  faceBounds[f].Expand(GetVertex(faceView[3 * f + 0]));
+                  faceBounds[f].Expand(GetVertex(faceView[3 * f + 1]));
+                  faceBounds[f].Expand(GetVertex(faceView[3 * f + 2]));
+                }
+              });
+  return faceBounds;
+}
+
+void TriangleMesh::BuildFaceArrays() {
+  const unsigned faceCount = GetFaceCount();
+  faceArrays.resize(faceCount);
+  faceNormals.resize(faceView.size);
+  ParallelFor(faceCount, ThreadCount(), [&](size_t begin, size_t end,
+                                            unsigned) {
+    for (size_t f = begin; f < end; f++) {
+      const tinyobj::index_t *idx = &faceView[3 * f];
+      const Vector3r v0 = GetVertex(idx[0]);
+      const Vector3r edge1 = GetVertex(idx[1]) - v0;
+      const Vector3r edge2 = GetVertex(idx[2]) - v0;
+      for (unsigned axis = 0; axis < 3; axis++) {
+        faceArrays.v0[axis][f] = v0[axis];
+        faceArrays.edge1[axis][f] = edge1[axis];
+        faceArrays.edge2[axis][f] = edge2[axis];
       }
-      index_offset += fv;
+      for (unsigned v = 0; v < 3; v++)
+        faceNormals[3 * f + v] = GetVertexNormal(idx[v]);
     }
+  });
+  faceArrayView = faceArrays;
+  faceNormalView = faceNormals;
+}
+
+void TriangleMesh::BuildAccelerator(const Accelerator::Settings &settings_) {
+  settings = settings_;
+  DetachCache();
+
+  auto timeStart = std::chrono::high_resolution_clock::now();
+  std::unique_ptr<Accelerator> built = Accelerator::Create(settings);
+  built->Build(GetFaceBounds(), *this);
+
+  // Faces the leaves reference together end up next to each other in memory
+  std::vector<unsigned> order = built->ReorderPrimitives(GetFaceCount());
+  if (!order.empty()) {
+    std::vector<tinyobj::index_t> reordered(faces.size());
+    ParallelFor(order.size(), ThreadCount(),
+                [&](size_t begin, size_t end, unsigned) {
+                  for (size_t f = begin; f < end; f++)
+                    for (unsigned v = 0; v < 3; v++)
+                      reordered[3 * f + v] = faces[3 * order[f] + v];
+                });
+    faces.swap(reordered);
+    faceView = faces;
   }
-  if (polygon_hit)
-    return distLowest;
-  else
-    return -1;
+  BuildFaceArrays();
+  accelerator = std::move(built);
+  builtSAHCost = accelerator->GetSAHCost();
+  cacheFile.reset();
+  auto timeEnd = std::chrono::high_resolution_clock::now();
+
+  std::cout << accelerator->GetName() << ": "
+            << accelerator->GetMemoryUsage() / 1024 << " KB, SAH cost "
+            << accelerator->GetSAHCost() << ", built in "
+            << std::chrono::duration<double, std::milli>(timeEnd - timeStart)
+                   .count()
+            << " ms" << std::endl;
 }
 
-Vector3d TriangleMesh::GetNormalAt(const Vector3d &) { return normal; }
+void TriangleMesh::UpdateVertices(const std::vector<tinyobj::real_t> &vertices,
+                                  const std::vector<tinyobj::real_t> &normals) {
+  DetachCache();
+  attrib.vertices = vertices;
+  vertexView = attrib.vertices;
+  if (!normals.empty()) {
+    attrib.normals = normals;
+    normalView = attrib.normals;
+  }
+
+  auto timeStart = std::chrono::high_resolution_clock::now();
+  bool refitted = accelerator->Refit(GetFaceBounds());
+  // The refitted accelerator may still view the cache file
+  double growth =
+      (builtSAHCost > 0) ? accelerator->GetSAHCost() / builtSAHCost : 1;
+  if (!refitted || growth > settings.maxRefitGrowth) {
+    BuildAccelerator(settings);
+    return;
+  }
+  BuildFaceArrays();
+  cacheFile.reset();
+  auto timeEnd = std::chrono::high_resolution_clock::now();
+
+  std::cout << accelerator->GetName() << ": refitted in "
+            << std::chrono::duration<double, std::milli>(timeEnd - timeStart)
+                   .count()
+            << " ms, SAH cost " << accelerator->GetSAHCost() << " ("
+            << growth << "x the built one)" << std::endl;
+}
 
-Vector3d TriangleMesh::GetTexCoords(Vector3d &, const Vector3d &) { return 0; }
+Vector3r TriangleMesh::GetVertex(const tinyobj::index_t &idx) const {
+  return Vector3r(vertexView[3 * idx.vertex_index + 0],
+                  vertexView[3 * idx.vertex_index + 1],
+                  vertexView[3 * idx.vertex_index + 2]);
+}
+
+Vector3r TriangleMesh::GetVertexNormal(const tinyobj::index_t &idx) const {
+  return Vector3r(normalView[3 * idx.normal_index + 0],
+                  normalView[3 * idx.normal_index + 1],
+                  normalView[3 * idx.normal_index + 2]);
+}
+
+Real TriangleMesh::IntersectFace(unsigned face, const Ray &ray, Real &u,
+                                 Real &v) const {
+  const TriangleArrayView &f = faceArrayView;
+  return Triangle::IntersectEdges(
+      Vector3r(f.v0[0][face], f.v0[1][face], f.v0[2][face]),
+      Vector3r(f.edge1[0][face], f.edge1[1][face], f.edge1[2][face]),
+      Vector3r(f.edge2[0][face], f.edge2[1][face], f.edge2[2][face]), ray, u,
+      v);
+}
+
+Real TriangleMesh::IntersectPrimitive(unsigned index, const Ray &ray) const {
+  Real u, v;
+  return IntersectFace(index, ray, u, v);
+}
+
+Real TriangleMesh::IntersectPrimitives(const unsigned *indices,
+                                       const unsigned count, const Ray &ray,
+                                       Real closest,
+                                       unsigned &primIndex) const {
+  return IntersectTriangles(faceArrayView, indices, count, ray, closest,
+                            primIndex);
+}
+
+bool TriangleMesh::OccludePrimitives(const unsigned *indices,
+                                     const unsigned count,
+                                     const Ray &ray) const {
+  return OccludeTriangles(faceArrayView, indices, count, ray);
+}
+
+void TriangleMesh::SplitPrimitive(unsigned index, int axis, Real position,
+                                  AABB &left, AABB &right) const {
+  left = right = AABB();
+  const Vector3r v[3] = {GetVertex(faceView[3 * index + 0]),
+                         GetVertex(faceView[3 * index + 1]),
+                         GetVertex(faceView[3 * index + 2])};
+
+  // Vertices go to their side of the plane, edges crossing it add the
+  // crossing point to both sides
+  for (unsigned i = 0; i < 3; i++) {
+    const Vector3r &v0 = v[i];
+    const Vector3r &v1 = v[(i + 1) % 3];
+    if (v0[axis] <= position) left.Expand(v0);
+    if (v0[axis] >= position) right.Expand(v0);
+
+    if ((v0[axis] < position && v1[axis] > position) ||
+        (v0[axis] > position && v1[axis] < position)) {
+      Real t = (position - v0[axis]) / (v1[axis] - v0[axis]);
+      Vector3r crossing = v0 + (v1 - v0) * t;
+      crossing[axis] = position;
+      left.Expand(crossing);
+      right.Expand(crossing);
+    }
+  }
+}
+
+Real TriangleMesh::IntersectFaces(const Ray &ray, unsigned &face,
+                                  TraversalStats *stats) const {
+  return accelerator->Intersect(ray, *this, face, stats);
+}
+
+bool TriangleMesh::OccludedFaces(const Ray &ray, TraversalStats *stats) const {
+  return accelerator->Occluded(ray, *this, stats);
+}
+
+Vector3r TriangleMesh::InterpolateNormal(const unsigned face, const Real u,
+                                         const Real v) const {
+  const Vector3r *n = &faceNormalView[3 * face];
+  return n[0] * (1 - u - v) + n[1] * u + n[2] * v;
+}
+
+bool TriangleMesh::Intersect(const Ray &ray, Hit &hit) const {
+  unsigned face;
+  Real distLowest = IntersectFaces(ray, face);
+  if (distLowest < 0) return false;
+
+  // Only the closest face needs its barycentrics for normal interpolation
+  IntersectFace(face, ray, hit.u, hit.v);
+  hit.t = distLowest;
+  hit.primitive = face;
+  hit.normal = InterpolateNormal(face, hit.u, hit.v);
+  const TriangleArrayView &f = faceArrayView;
+  const Vector3r edge1(f.edge1[0][face], f.edge1[1][face], f.edge1[2][face]);
+  const Vector3r edge2(f.edge2[0][face], f.edge2[1][face], f.edge2[2][face]);
+  hit.geometricNormal = edge1.Cross(edge2).Normalize();
+  return true;
+}
+
+bool TriangleMesh::Occluded(const Ray &ray, const Real tMax) const {
+  Ray shadowRay = ray;
+  shadowRay.tMax = tMax;
+  return OccludedFaces(shadowRay);
+}
+
+size_t TriangleMesh::GetMemoryUsage() const {
+  return sizeof(TriangleMesh) +
+         (vertexView.size + normalView.size) * sizeof(tinyobj::real_t) +
+         faceView.size * sizeof(tinyobj::index_t) +
+         faceArrayView.GetMemoryUsage() +
+         faceNormalView.size * sizeof(Vector3r) +
+         accelerator->GetMemoryUsage();
+}
+
+bool TriangleMesh::GetBounds(AABB &bounds) const {
+  bounds = accelerator->GetBounds();
+  return !bounds.IsEmpty();
+}
@@ -2,23 +2,96 @@
 //#define TINYOBJLOADER_IMPLEMENTATION
 #include <iostream>
 #include <memory>
+#include "Accelerator.h"
 #include "Globals.h"
+#include "MeshCache.h"
 #include "Triangle.h"
+#include "TriangleKernel.h"
 #include "tiny_obj_loader.h"
 
-class TriangleMesh : public Object {
+// Parsed meshes and their accelerator are cached to disk (MESH_CACHE_DIRECTORY)
+// keyed by the OBJ content and the accelerator settings. Later runs map the
+// cache file and use it in place, without parsing or building anything
+class TriangleMesh : public Object, public PrimitiveIntersector {
  public:
-  TriangleMesh(const char *file);
-  double GetIntersection(const Ray &ray);
-  Vector3d GetNormalAt(const Vector3d &intersectionPosition);
-  Vector3d GetTexCoords(Vector3d &normal, const Vector3d &hitPoint);
+  TriangleMesh(const char *file,
+               const Accelerator::Settings &settings = Accelerator::Settings());
+  bool Intersect(const Ray &ray, Hit &hit) const;
+  bool Occluded(const Ray &ray, const Real tMax) const;
+  bool GetBounds(AABB &bounds) const;
+
+  // (Re)builds the face accelerator and prints its build statistics. Faces
+  // are reordered the way the accelerator references them
+  void BuildAccelerator(const Accelerator::Settings &settings);
+  // Moves the vertices of an animated mesh (same topology, normals are
+  // optional) and refits the accelerator. Rebuilds instead once refits grew
+  // its SAH cost past Settings::maxRefitGrowth times the built one.
+  // Only the mesh is updated: call Scene::RefitAccelerator afterwards so the
+  // bounds of its instances and the scene accelerator follow
+  void UpdateVertices(const std::vector<tinyobj::real_t> &vertices,
+                      const std::vector<tinyobj::real_t> &normals = {});
+  const Accelerator &GetAccelerator() const { return *accelerator; }
+  unsigned GetFaceCount() const { return faceView.size / 3; }
+  // Vertices, normals, faces and accelerator
+  size_t GetMemoryUsage() const;
+
+  // Closest face along the ray, -1 on a miss
+  Real IntersectFaces(const Ray &ray, unsigned &face,
+                      TraversalStats *stats = nullptr) const;
+  // Whether any face blocks the ray before ray.tMax
+  bool OccludedFaces(const Ray &ray, TraversalStats *stats = nullptr) const;
+  // Vertex normal interpolated at barycentric coordinates u, v of the face
+  Vector3r InterpolateNormal(const unsigned face, const Real u,
+                             const Real v) const;
+  // Used by the accelerator, tests / splits a single face
+  Real IntersectPrimitive(unsigned index, const Ray &ray) const;
+  // Whole leaves at once through the batched kernel, see TriangleKernel.h
+  Real IntersectPrimitives(const unsigned *indices, const unsigned count,
+                           const Ray &ray, Real closest,
+                           unsigned &primIndex) const;
+  bool OccludePrimitives(const unsigned *indices, const unsigned count,
+                         const Ray &ray) const;
+  void SplitPrimitive(unsigned index, int axis, Real position, AABB &left,
+                      AABB &right) const;
 
   tinyobj::attrib_t attrib;
   std::vector<tinyobj::shape_t> shapes;
   std::vector<tinyobj::material_t> materials;
   std::string err;
-  Triangle tri;
-  Vector3d n0, n1, n2, normal;
-  Vector3d uv;
-  Vector3d st0, st1, st2, texCoords;
+
+ private:
+  Vector3r GetVertex(const tinyobj::index_t &idx) const;
+  Vector3r GetVertexNormal(const tinyobj::index_t &idx) const;
+
+  std::vector<AABB> GetFaceBounds() const;
+  // Refills faceArrays and faceNormals from the vertices and face order and
+  // points their views at them
+  void BuildFaceArrays();
+  // Moller-Trumbore on the precomputed face, see Triangle::IntersectEdges
+  Real IntersectFace(unsigned face, const Ray &ray, Real &u,
+                     Real &v) const;
+  // Copies the arrays out of the read only cache file before changing them
+  void DetachCache();
+  bool LoadCache(const std::string &path);
+  void SaveCache(const std::string &path) const;
+
+  // Vertex / normal indices of every face of every shape, 3 per triangle
+  std::vector<tinyobj::index_t> faces;
+  // Point either at attrib / faces or into the mapped cache file
+  ArrayView<tinyobj::real_t> vertexView, normalView;
+  ArrayView<tinyobj::index_t> faceView;
+  std::unique_ptr<MappedFile> cacheFile;
+  // Faces in the order the accelerator references them, laid out for the
+  // intersection kernel: one array per coordinate of v0 and of the edges
+  // v1 - v0 and v2 - v0, so it reads them without going through the indices
+  TriangleArrays faceArrays;
+  // Vertex normals of every face, 3 per face, only read for shading
+  std::vector<Vector3r> faceNormals;
+  // What intersection and shading read, faceArrays / faceNormals or the
+  // same arrays in the mapped cache file
+  TriangleArrayView faceArrayView;
+  ArrayView<Vector3r> faceNormalView;
+  std::unique_ptr<Accelerator> accelerator;
+  Accelerator::Settings settings;
+  double builtSAHCost = 0;  // right after the last build, to track refits
 };
@@ -2,6 +2,7 @@
 #define _USE_MATH_DEFINES
 #include <algorithm>
 #include <cmath>
+#include <cstdint>
 #include "Globals.h"
 
 template <typename T>
@@ -113,5 +114,7 @@ struct Vector3 {
   }
 };
 
-typedef Vector3<double> Vec3d;
 typedef Vector3<double> Vector3d;
+typedef Vector3<float> Vector3f;
+// Rays, geometry and acceleration structures, see Real
+typedef Vector3<Real> Vector3r;
@@ -0,0 +1,455 @@
+#include "WideBVH.h"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include "Refit.h"
+#if defined(__SSE__) || defined(__AVX__)
+#include <immintrin.h>
+#endif
+
+namespace {
+// Ray in single precision, shared by all node tests of one traversal
+struct WideRay {
+  float origin[3];
+  float invDir[3];
+  int sign[3];
+  float tMin;
+};
+
+// Child boxes are widened slightly when rounded to float so the single
+// precision slab test can never miss a box the full precision one hits
+inline float RoundDown(const double v) {
+  return std::nextafter(float(v - std::fabs(v) * 1e-6), -FLT_MAX);
+}
+
+inline float RoundUp(const double v) {
+  return std::nextafter(float(v + std::fabs(v) * 1e-6), FLT_MAX);
+}
+
+// Slab test against all children, returns a bit mask of the children hit
+// and their entry distances in tNear
+template <unsigned N>
+inline unsigned IntersectChildren(const WideBVHNode<N> &node,
+                                  const WideRay &ray, const float tMax,
+                                  float tNear[N]) {
+  unsigned mask = 0;
+  for (unsigned i = 0; i < N; i++) {
+    float t0 = ray.tMin, t1 = tMax;
+    for (unsigned axis = 0; axis < 3; axis++) {
+      float tn = (node.bounds[ray.sign[axis]][axis][i] - ray.origin[axis]) *
+                 ray.invDir[axis];
+      float tf =
+          (node.bounds[1 - ray.sign[axis]][axis][i] - ray.origin[axis]) *
+          ray.invDir[axis];
+      t0 = std::max(t0, tn);
+      t1 = std::min(t1, tf);
+    }
+    tNear[i] = t0;
+    if (t0 <= t1) mask |= 1 << i;
+  }
+  return mask;
+}
+
+#ifdef __SSE__
+template <>
+inline unsigned IntersectChildren<4>(const WideBVHNode<4> &node,
+                                     const WideRay &ray, const float tMax,
+                                     float tNear[4]) {
+  __m128 t0 = _mm_set1_ps(ray.tMin);
+  __m128 t1 = _mm_set1_ps(tMax);
+  for (unsigned axis = 0; axis < 3; axis++) {
+    const __m128 origin = _mm_set1_ps(ray.origin[axis]);
+    const __m128 invDir = _mm_set1_ps(ray.invDir[axis]);
+    __m128 tn = _mm_mul_ps(
+        _mm_sub_ps(_mm_load_ps(node.bounds[ray.sign[axis]][axis]), origin),
+        invDir);
+    __m128 tf = _mm_mul_ps(
+        _mm_sub_ps(_mm_load_ps(node.bounds[1 - ray.sign[axis]][axis]), origin),
+        invDir);
+    t0 = _mm_max_ps(t0, tn);
+    t1 = _mm_min_ps(t1, tf);
+  }
+  _mm_storeu_ps(tNear, t0);
+  return _mm_movemask_ps(_mm_cmple_ps(t0, t1));
+}
+#endif
+
+#ifdef __AVX__
+template <>
+inline unsigned IntersectChildren<8>(const WideBVHNode<8> &node,
+                                     const WideRay &ray, const float tMax,
+                                     float tNear[8]) {
+  __m256 t0 = _mm256_set1_ps(ray.tMin);
+  __m256 t1 = _mm256_set1_ps(tMax);
+  for (unsigned axis = 0; axis < 3; axis++) {
+    const __m256 origin = _mm256_set1_ps(ray.origin[axis]);
+    const __m256 invDir = _mm256_set1_ps(ray.invDir[axis]);
+    __m256 tn = _mm256_mul_ps(
+        _mm256_sub_ps(_mm256_load_ps(node.bounds[ray.sign[axis]][axis]),
+                      origin),
+        invDir);
+    __m256 tf = _mm256_mul_ps(
+        _mm256_sub_ps(_mm256_load_ps(node.bounds[1 - ray.sign[axis]][axis]),
+                      origin),
+        invDir);
+    t0 = _mm256_max_ps(t0, tn);
+    t1 = _mm256_min_ps(t1, tf);
+  }
+  _mm256_storeu_ps(tNear, t0);
+  return _mm256_movemask_ps(_mm256_cmp_ps(t0, t1, _CMP_LE_OQ));
+}
+#endif
+}  // namespace
+
+template <unsigned N>
+WideBVH<N>::WideBVH(const Settings &settings_)
+    : settings{settings_},
+      name{"BVH" + std::to_string(N) + " (" +
+           GetBuilderName(settings.builder) + ")"} {}
+
+template <unsigned N>
+void WideBVH<N>::Build(const std::vector<AABB> &primBounds,
+                       const PrimitiveIntersector &primitives) {
+  nodes.clear();
+  primIndices.clear();
+
+  BVH binary(settings);
+  binary.Build(primBounds, primitives);
+  bounds = binary.GetBounds();
+  if (!binary.nodes.empty()) {
+    nodes.reserve(binary.nodes.size() / (N - 1) + 1);
+    Collapse(binary, 0);
+    primIndices = binary.primIndices;
+  }
+
+  nodeView = nodes;
+  primView = primIndices;
+}
+
+// Pulls the children of the largest interior children up into this node
+// until it holds N of them
+template <unsigned N>
+unsigned WideBVH<N>::Collapse(const BVH &binary, const unsigned binaryNode) {
+  const unsigned nodeIndex = nodes.size();
+  nodes.emplace_back();
+
+  std::vector<unsigned> children;
+  const BVHNode &root = binary.nodes[binaryNode];
+  if (root.count)
+    children.emplace_back(binaryNode);
+  else {
+    children.emplace_back(binaryNode + 1);
+    children.emplace_back(root.offset);
+  }
+
+  while (children.size() < N) {
+    int largest = -1;
+    double largestArea = -1;
+    for (unsigned i = 0; i < children.size(); i++) {
+      const BVHNode &child = binary.nodes[children[i]];
+      if (!child.count && child.bounds.SurfaceArea() > largestArea) {
+        largest = i;
+        largestArea = child.bounds.SurfaceArea();
+      }
+    }
+    if (largest < 0) break;
+
+    const unsigned expanded = children[largest];
+    children[largest] = expanded + 1;
+    children.emplace_back(binary.nodes[expanded].offset);
+  }
+
+  // Empty slots get an inverted box that no ray can hit
+  for (unsigned i = 0; i < N; i++) {
+    for (unsigned axis = 0; axis < 3; axis++) {
+      nodes[nodeIndex].bounds[0][axis][i] = FLT_MAX;
+      nodes[nodeIndex].bounds[1][axis][i] = -FLT_MAX;
+    }
+    nodes[nodeIndex].offset[i] = 0;
+    nodes[nodeIndex].count[i] = 0;
+  }
+
+  for (unsigned i = 0; i < children.size(); i++) {
+    const BVHNode &child = binary.nodes[children[i]];
+    const Vector3r (&childBounds)[2] = child.bounds.bounds;
+    for (unsigned axis = 0; axis < 3; axis++) {
+      nodes[nodeIndex].bounds[0][axis][i] = RoundDown(childBounds[0][axis]);
+      nodes[nodeIndex].bounds[1][axis][i] = RoundUp(childBounds[1][axis]);
+    }
+    if (child.count) {
+      nodes[nodeIndex].offset[i] = child.offset;
+      nodes[nodeIndex].count[i] = child.count;
+    } else {
+      // nodes may be reallocated by the recursion
+      unsigned childIndex = Collapse(binary, children[i]);
+      nodes[nodeIndex].offset[i] = childIndex;
+    }
+  }
+  return nodeIndex;
+}
+
+template <unsigned N>
+Real WideBVH<N>::Intersect(const Ray &ray,
+                           const PrimitiveIntersector &primitives,
+                           unsigned &primIndex, TraversalStats *stats) const {
+  if (nodeView.empty()) return -1;
+
+  WideRay wideRay;
+  const Vector3r origin = ray.GetOrigin();
+  for (uint8_t axis = 0; axis < 3; axis++) {
+    wideRay.origin[axis] = origin[axis];
+    wideRay.invDir[axis] = ray.invDir[axis];
+    wideRay.sign[axis] = ray.sign[axis];
+  }
+  wideRay.tMin = ray.tMin;
+
+  Real closest = ray.tMax;
+  bool hit = false;
+
+  // Leaves are pushed like nodes so they are tested in distance order too
+  struct Entry {
+    unsigned offset, count;
+    float tNear;
+  } stack[N * BVH_MAX_DEPTH];
+  unsigned stackSize = 0;
+  stack[stackSize++] = {0, 0, 0};
+
+  while (stackSize) {
+    const Entry entry = stack[--stackSize];
+    if (entry.tNear > closest) continue;
+
+    if (entry.count) {
+      if (stats) stats->primitiveTests += entry.count;
+      Real t = primitives.IntersectPrimitives(
+          &primView[entry.offset], entry.count, ray, closest, primIndex);
+      if (t > 0) {
+        closest = t;
+        hit = true;
+      }
+      continue;
+    }
+
+    const WideBVHNode<N> &node = nodeView[entry.offset];
+    if (stats) stats->nodeVisits++;
+    float tNear[N];
+    // Scaled up a little to absorb the float rounding of the far distance
+    unsigned mask =
+        IntersectChildren<N>(node, wideRay, float(closest) * 1.0000005f, tNear);
+
+    // Insertion sort the hit children far to near, so the nearest child is
+    // popped first
+    Entry hits[N];
+    unsigned hitCount = 0;
+    while (mask) {
+      unsigned i = __builtin_ctz(mask);
+      mask &= mask - 1;
+      Entry child = {node.offset[i], node.count[i], tNear[i]};
+      unsigned j = hitCount++;
+      while (j > 0 && hits[j - 1].tNear < child.tNear) {
+        hits[j] = hits[j - 1];
+        j--;
+      }
+      hits[j] = child;
+    }
+    for (unsigned i = 0; i < hitCount; i++) stack[stackSize++] = hits[i];
+  }
+
+  return hit ? closest : -1;
+}
+
+template <unsigned N>
+bool WideBVH<N>::Occluded(const Ray &ray,
+                          const PrimitiveIntersector &primitives,
+                          TraversalStats *stats) const {
+  if (nodeView.empty()) return false;
+
+  WideRay wideRay;
+  const Vector3r origin = ray.GetOrigin();
+  for (uint8_t axis = 0; axis < 3; axis++) {
+    wideRay.origin[axis] = origin[axis];
+    wideRay.invDir[axis] = ray.invDir[axis];
+    wideRay.sign[axis] = ray.sign[axis];
+  }
+  wideRay.tMin = ray.tMin;
+  const float tMax = float(ray.tMax) * 1.0000005f;
+
+  // Any order will do, so children are pushed as they come without sorting
+  struct Entry {
+    unsigned offset, count;
+  } stack[N * BVH_MAX_DEPTH];
+  unsigned stackSize = 0;
+  stack[stackSize++] = {0, 0};
+
+  while (stackSize) {
+    const Entry entry = stack[--stackSize];
+    if (entry.count) {
+      if (stats) stats->primitiveTests += entry.count;
+      if (primitives.OccludePrimitives(&primView[entry.offset], entry.count,
+                                       ray))
+        return true;
+      continue;
+    }
+
+    const WideBVHNode<N> &node = nodeView[entry.offset];
+    if (stats) stats->nodeVisits++;
+    float tNear[N];
+    unsigned mask = IntersectChildren<N>(node, wideRay, tMax, tNear);
+    while (mask) {
+      unsigned i = __builtin_ctz(mask);
+      mask &= mask - 1;
+      stack[stackSize++] = {node.offset[i], node.count[i]};
+    }
+  }
+  return false;
+}
+
+template <unsigned N>
+AABB WideBVH<N>::GetBounds() const {
+  return bounds;
+}
+
+template <unsigned N>
+const char *WideBVH<N>::GetName() const {
+  return name.c_str();
+}
+
+template <unsigned N>
+size_t WideBVH<N>::GetMemoryUsage() const {
+  return nodeView.size * sizeof(WideBVHNode<N>) +
+         primView.size * sizeof(unsigned);
+}
+
+template <unsigned N>
+double WideBVH<N>::GetSAHCost() const {
+  if (nodeView.empty()) return 0;
+  auto area = [](const WideBVHNode<N> &node, unsigned i) {
+    double dx = node.bounds[1][0][i] - node.bounds[0][0][i];
+    double dy = node.bounds[1][1][i] - node.bounds[0][1][i];
+    double dz = node.bounds[1][2][i] - node.bounds[0][2][i];
+    return (dx < 0) ? 0 : 2 * (dx * dy + dy * dz + dz * dx);
+  };
+  double rootArea = bounds.SurfaceArea();
+  if (rootArea <= 0) return 0;
+
+  // One traversal step per node visit (all children at once), plus the
+  // primitives of every leaf child weighted by its hit probability
+  double cost = BVH_TRAVERSAL_COST;
+  for (const auto &node : nodeView) {
+    for (unsigned i = 0; i < N; i++) {
+      double childArea = area(node, i) / rootArea;
+      cost += childArea * (node.count[i] ? node.count[i] : BVH_TRAVERSAL_COST);
+    }
+  }
+  return cost;
+}
+
+template <unsigned N>
+bool WideBVH<N>::Refit(const std::vector<AABB> &primBounds) {
+  if (nodes.empty() && !nodeView.empty()) {
+    nodes.assign(nodeView.begin(), nodeView.end());
+    primIndices.assign(primView.begin(), primView.end());
+    nodeView = nodes;
+    primView = primIndices;
+  }
+
+  // Interior children are the slots without primitives, except empty slots
+  // which point at the root. They were emitted in slot order
+  auto splitRange = [&](unsigned start, unsigned end,
+                        std::vector<std::pair<unsigned, unsigned>> &children) {
+    const WideBVHNode<N> &node = nodes[start];
+    for (unsigned i = 0; i < N; i++) {
+      if (node.count[i] || !node.offset[i]) continue;
+      if (!children.empty()) children.back().second = node.offset[i];
+      children.push_back({node.offset[i], end});
+    }
+  };
+  auto refitNode = [&](unsigned index) {
+    WideBVHNode<N> &node = nodes[index];
+    for (unsigned i = 0; i < N; i++) {
+      if (node.count[i]) {
+        AABB leafBounds;
+        for (unsigned j = node.offset[i]; j < node.offset[i] + node.count[i];
+             j++)
+          leafBounds.Expand(primBounds[primIndices[j]]);
+        for (uint8_t axis = 0; axis < 3; axis++) {
+          node.bounds[0][axis][i] = RoundDown(leafBounds.bounds[0][axis]);
+          node.bounds[1][axis][i] = RoundUp(leafBounds.bounds[1][axis]);
+        }
+      } else if (node.offset[i]) {
+        // Already rounded outwards, empty slots of the child don't count
+        // as their boxes are inverted
+        const WideBVHNode<N> &child = nodes[node.offset[i]];
+        for (uint8_t axis = 0; axis < 3; axis++) {
+          node.bounds[0][axis][i] = *std::min_element(
+              child.bounds[0][axis], child.bounds[0][axis] + N);
+          node.bounds[1][axis][i] = *std::max_element(
+              child.bounds[1][axis], child.bounds[1][axis] + N);
+        }
+      }
+    }
+  };
+  RefitTree(nodes.size(), splitRange, refitNode);
+
+  bounds = AABB();
+  for (uint8_t axis = 0; axis < 3; axis++) {
+    bounds.bounds[0][axis] = *std::min_element(nodes[0].bounds[0][axis],
+                                               nodes[0].bounds[0][axis] + N);
+    bounds.bounds[1][axis] = *std::max_element(nodes[0].bounds[1][axis],
+                                               nodes[0].bounds[1][axis] + N);
+  }
+  return true;
+}
+
+template <unsigned N>
+std::vector<DataBlock> WideBVH<N>::GetArrays() const {
+  return {nodeView.ToBlock(), primView.ToBlock(), {&bounds, sizeof(bounds)}};
+}
+
+template <unsigned N>
+bool WideBVH<N>::SetArrays(const std::vector<DataBlock> &arrays,
+                           const unsigned primCount) {
+  if (arrays.size() != 3 || arrays[2].size != sizeof(bounds) ||
+      !nodeView.FromBlock(arrays[0]) || !primView.FromBlock(arrays[1]) ||
+      !IndicesBelow(primView, primCount))
+    return false;
+
+  // Child nodes come after their parent, so traversal can't loop, and paths
+  // fit the traversal stack. Empty slots must keep the inverted box no ray
+  // hits, they would lead back to the root otherwise
+  std::vector<unsigned> nodeDepths(nodeView.size, 0);
+  if (!nodeDepths.empty()) nodeDepths[0] = 1;
+  for (unsigned i = 0; i < nodeView.size; i++) {
+    const WideBVHNode<N> &node = nodeView[i];
+    for (unsigned c = 0; c < N; c++) {
+      if (node.count[c]) {
+        if (!RangeWithin(node.offset[c], node.count[c], primView.size))
+          return false;
+      } else if (!node.offset[c]) {
+        for (unsigned axis = 0; axis < 3; axis++)
+          if (node.bounds[0][axis][c] != FLT_MAX ||
+              node.bounds[1][axis][c] != -FLT_MAX)
+            return false;
+      } else {
+        if (node.offset[c] <= i || node.offset[c] >= nodeView.size ||
+            nodeDepths[i] >= BVH_MAX_DEPTH)
+          return false;
+        nodeDepths[node.offset[c]] =
+            std::max(nodeDepths[node.offset[c]], nodeDepths[i] + 1);
+      }
+    }
+  }
+
+  nodes.clear();
+  primIndices.clear();
+  bounds = *static_cast<const AABB *>(arrays[2].data);
+  return true;
+}
+
+template <unsigned N>
+std::vector<unsigned> WideBVH<N>::ReorderPrimitives(const unsigned primCount) {
+  if (primIndices.empty()) return {};
+  return RenumberPrimitives(primIndices, primCount);
+}
+
+template class WideBVH<4>;
+template class WideBVH<8>;
@@ -0,0 +1,54 @@
+#pragma once
+#include <string>
+#include <vector>
+#include "BVH.h"
+
+// N wide BVH node. Child boxes are stored as floats in structure of arrays
+// layout so one SIMD register holds the same plane of every child
+template <unsigned N>
+struct alignas(32) WideBVHNode {
+  float bounds[2][3][N];  // [min / max][axis][child]
+  unsigned offset[N];     // child node (interior) or first primitive (leaf)
+  unsigned count[N];      // primitives of a leaf child, 0 for interior / empty
+};
+
+// BVH4 / BVH8: a binary BVH collapsed so every node holds up to N children,
+// which are all tested against the ray at once and visited nearest first
+template <unsigned N>
+class WideBVH : public Accelerator {
+ public:
+  WideBVH(const Settings &settings_ = Settings());
+
+  void Build(const std::vector<AABB> &primBounds,
+             const PrimitiveIntersector &primitives);
+
+  Real Intersect(const Ray &ray, const PrimitiveIntersector &primitives,
+                 unsigned &primIndex, TraversalStats *stats = nullptr) const;
+  bool Occluded(const Ray &ray, const PrimitiveIntersector &primitives,
+                TraversalStats *stats = nullptr) const;
+
+  AABB GetBounds() const;
+  const char *GetName() const;
+  size_t GetMemoryUsage() const;
+  double GetSAHCost() const;
+
+  bool Refit(const std::vector<AABB> &primBounds);
+
+  std::vector<DataBlock> GetArrays() const;
+  bool SetArrays(const std::vector<DataBlock> &arrays,
+                 const unsigned primCount);
+  std::vector<unsigned> ReorderPrimitives(const unsigned primCount);
+
+  // Filled by Build, empty when running on a cache file
+  std::vector<WideBVHNode<N>> nodes;
+  std::vector<unsigned> primIndices;
+
+ private:
+  unsigned Collapse(const BVH &binary, const unsigned binaryNode);
+
+  Settings settings;
+  std::string name;
+  AABB bounds;
+  ArrayView<WideBVHNode<N>> nodeView;
+  ArrayView<unsigned> primView;
+};
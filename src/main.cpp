@@ -4,65 +4,59 @@
 
 #include <time.h>
 #include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
 #include <sstream>
-#include <thread>
 #include <vector>
+#include "Benchmark.h"
 #include "Camera.h"
+#include "CellOrder.h"
 #include "Matrix44.h"
 #include "Scene.h"
+#include "ThreadPool.h"
 #include "TriangleMesh.h"
 #include "bitmap_image.hpp"
 
-std::atomic<int> numPrimaryRays;
-std::atomic<int> numPrimaryHitRays;
-std::atomic<int> numSecondaryRays;
-
-Color Trace(const Vector3d &position, const Vector3d &sceneDirection,
-            const std::vector<std::shared_ptr<Object>> &sceneObjects,
-            const int indexOfClosestObject,
-            const std::vector<std::shared_ptr<Light>> &lightSources,
-            const int &depth);
-
-// Returns the closest object's index that the ray intersected with
-int ClosestObjectIndex(const std::vector<double> &intersections) {
-  int minValueIndex = 0;
-
-  // Prevent unnecessary calculations (only check the ones that intersect)
-  if (intersections.size() == 0)  // No intersections
-    return -1;
-
-  else if (intersections.size() == 1) {
-    if (intersections[0] >
-        0)  // If intersection is greater than 0, then it's our index of minimum
-            // value (0th element in vector)
-      return 0;
-    else  // Otherwise the only intersection value is negative (ray missed
-          // everything)
-      return -1;
-  } else  // If there's more than 1 intersection, find the MAX value
-  {
-    double max =
-        *max_element(std::begin(intersections), std::end(intersections));
-    if (max > 0) {
-      // Only searh for positive intersections
-      // Find the minimum POSITIVE value
-      for (int intersectionIndex = 0; intersectionIndex < intersections.size();
-           intersectionIndex++) {
-        // If intersection is positive and is lower or equal to the max
-        // intersection
-        if (intersections[intersectionIndex] > 0 &&
-            intersections[intersectionIndex] <= max) {
-          max = intersections[intersectionIndex];
-          minValueIndex = intersectionIndex;
-        }
-      }
-      return minValueIndex;
-    } else {
-      // All intersections were negative (didn't hit anything)
-      return -1;
-    }
+// Rays traced by type and the scene traversal work they took. Each thread
+// counts into its own and they are summed once the render is done, so
+// counting never writes to memory shared between threads
+struct RayStats {
+  uint64_t primaryRays = 0, primaryHits = 0;
+  uint64_t shadowRays = 0, reflectionRays = 0, refractionRays = 0;
+  uint64_t shadowCacheTests = 0, shadowCacheHits = 0;
+  TraversalStats traversal;  // over rays of all types
+
+  uint64_t Rays() const {
+    return primaryRays + shadowRays + reflectionRays + refractionRays;
   }
-}
+  RayStats &operator+=(const RayStats &other) {
+    primaryRays += other.primaryRays;
+    primaryHits += other.primaryHits;
+    shadowRays += other.shadowRays;
+    reflectionRays += other.reflectionRays;
+    refractionRays += other.refractionRays;
+    shadowCacheTests += other.shadowCacheTests;
+    shadowCacheHits += other.shadowCacheHits;
+    traversal.nodeVisits += other.traversal.nodeVisits;
+    traversal.primitiveTests += other.traversal.primitiveTests;
+    return *this;
+  }
+};
+thread_local RayStats rayStats;
+RayStats totalRayStats;
+
+// Object that blocked this thread's last shadow ray toward each light, see
+// SHADOW_CACHE_ON
+struct ShadowCache {
+  std::vector<int> occluders;  // per light, -1 until something blocks it
+};
+thread_local ShadowCache shadowCache;
+// Picks lights in scenes with more than LIGHT_SAMPLES of them
+thread_local std::minstd_rand lightRng;
+
+Color Trace(const Vector3r &position, const Vector3r &sceneDirection,
+            const Scene &scene, const Hit &hit, const unsigned &depth);
 
 double clamp(const double lo, const double hi, const double v) {
   return std::max(lo, std::min(hi, v));
@@ -70,11 +64,11 @@ double clamp(const double lo, const double hi, const double v) {
 
 inline double deg2rad(const double deg) { return deg * M_PI / 180; }
 
-double fresnel(const Vector3d &sceneDirection, const Vector3d &normal,
+double fresnel(const Vector3r &sceneDirection, const Vector3r &normal,
                const double ior) {
   double kr;
-  Vector3d I = sceneDirection;
-  Vector3d N = normal;
+  Vector3r I = sceneDirection;
+  Vector3r N = normal;
   double cosi = clamp(-1, 1, I.Dot(N));
   double etai = GLOBAL_REFRACTION, etat = ior;
   if (cosi > 0) {
@@ -97,22 +91,26 @@ double fresnel(const Vector3d &sceneDirection, const Vector3d &normal,
   return kr;
 }
 
-Ray GetReflectionRay(const Vector3d &normal, const Vector3d &sceneDirection,
-                     const Vector3d &position) {
+// Reflected about the shading normal, leaving the surface with the
+// geometric normal
+Ray GetReflectionRay(const Vector3r &normal, const Vector3r &sceneDirection,
+                     const Vector3r &position,
+                     const Vector3r &geometricNormal) {
   const double cosI = normal.Dot(sceneDirection);
 
-  Vector3d reflectionDirection = sceneDirection - normal * 2 * cosI;
-  Vector3d offset = reflectionDirection * BIAS;
+  Vector3r reflectionDirection = sceneDirection - normal * 2 * cosI;
 
-  Ray reflectionRay(position + offset, reflectionDirection);
+  Ray reflectionRay(
+      OffsetRayOrigin(position, geometricNormal, reflectionDirection),
+      reflectionDirection);
   return reflectionRay;
 }
 
-Vector3d GetRefraction(const Vector3d &incident, const Vector3d &normal,
+Vector3r GetRefraction(const Vector3r &incident, const Vector3r &normal,
                        const double ior) {
   double cosi = clamp(-1, 1, incident.Dot(normal));
   double etai = GLOBAL_REFRACTION, etat = ior;
-  Vector3d n = normal;
+  Vector3r n = normal;
   if (cosi < 0)
     cosi = -cosi;
   else
@@ -120,67 +118,55 @@ Vector3d GetRefraction(const Vector3d &incident, const Vector3d &normal,
   n = -normal;
   double eta = etai / etat;
   double k = 1 - eta * eta * (1 - cosi * cosi);
-  Vector3d a = incident * eta + normal * (eta * cosi - sqrt(k));
+  Vector3r a = incident * eta + normal * (eta * cosi - sqrt(k));
 
   if (k < 0) {
     // return 0;
     a = incident * eta + normal * (eta * cosi - sqrt(k));
-    Ray reflRay = GetReflectionRay(normal, incident, a);
+    Ray reflRay = GetReflectionRay(normal, incident, a, normal);
     return reflRay.GetDirection();
   } else
     return a;
 }
 
 // Calculate reflection colors
-Color GetReflections(const Vector3d &position, const Vector3d &sceneDirection,
-                     const std::vector<std::shared_ptr<Object>> &sceneObjects,
-                     const int indexOfClosestObject,
-                     const std::vector<std::shared_ptr<Light>> &lightSources,
-                     int depth) {
+Color GetReflections(const Vector3r &position, const Vector3r &sceneDirection,
+                     const Scene &scene, const Hit &hit, unsigned depth) {
   if (REFLECTIONS_ON &&
-      /*depth <= DEPTH && */ indexOfClosestObject !=
+      /*depth <= DEPTH && */ hit.object !=
           -1)  // Not checking depth for infinite mirror effect
   {
-    std::shared_ptr<Object> sceneObject = sceneObjects[indexOfClosestObject];
-    double reflection = sceneObject->material.GetReflection();
-    if (reflection > 0 &&
-        sceneObject->material.GetRefraction() != GLOBAL_REFRACTION) {
-      if (sceneObject->material.GetSpecular() > 0 &&
-          sceneObject->material.GetSpecular() <= 1) {
-        Vector3d normal = sceneObject->GetNormalAt(position);
-        Ray reflectionRay = GetReflectionRay(normal, sceneDirection, position);
+    const Material &material = scene.GetMaterial(hit.object);
+    double reflection = material.GetReflection();
+    if (reflection > 0 && material.GetRefraction() != GLOBAL_REFRACTION) {
+      if (material.GetSpecular() > 0 && material.GetSpecular() <= 1) {
+        Ray reflectionRay =
+            GetReflectionRay(hit.normal, sceneDirection, position,
+                             hit.geometricNormal);
 
         // determine what the ray intersects with first
-        std::vector<double> reflectionIntersections;
-        reflectionIntersections.reserve(1024);
-        for (const auto &object : sceneObjects) {
-          reflectionIntersections.emplace_back(
-              object->GetIntersection(reflectionRay));
-        }
+        Hit reflectionHit;
+        scene.Intersect(reflectionRay, reflectionHit, &rayStats.traversal);
+        rayStats.reflectionRays++;
 
-        int closestObjectWithReflection =
-            ClosestObjectIndex(reflectionIntersections);
-
-        if (closestObjectWithReflection !=
-            indexOfClosestObject)  // Makes infinite
-                                   // mirror effect
+        if (reflectionHit.object != hit.object)  // Makes infinite
+                                                 // mirror effect
         {
           // reflection ray missed everthing else
-          if (reflectionIntersections[closestObjectWithReflection] > BIAS) {
+          if (reflectionHit.object != -1) {
             // determine the position and
             // sceneDirectionection at the
             // position of intersection with
             // the reflection ray the ray
             // only affects the color if it
             // reflected off something
-            Vector3d reflectionIntersectionPosition =
+            Vector3r reflectionIntersectionPosition =
                 reflectionRay.GetOrigin() +
-                (reflectionRay.GetDirection() *
-                 (reflectionIntersections[closestObjectWithReflection]));
+                (reflectionRay.GetDirection() * reflectionHit.t);
             Color reflectionIntersectionColor =
                 Trace(reflectionIntersectionPosition,
-                      reflectionRay.GetDirection(), sceneObjects,
-                      closestObjectWithReflection, lightSources, depth + 1);
+                      reflectionRay.GetDirection(), scene, reflectionHit,
+                      depth + 1);
             return reflectionIntersectionColor * reflection;
           } else
             return Color(0);
@@ -194,62 +180,46 @@ Color GetReflections(const Vector3d &position, const Vector3d &sceneDirection,
     return Color(0);
 }
 
-Color GetRefractions(const Vector3d &position, const Vector3d &dir,
-                     const std::vector<std::shared_ptr<Object>> &sceneObjects,
-                     const int &indexOfClosestObject,
-                     const std::vector<std::shared_ptr<Light>> &lightSources,
-                     int depth) {
-  if (indexOfClosestObject != -1) {
-    std::shared_ptr<Object> sceneObject = sceneObjects[indexOfClosestObject];
-
-    double ior = sceneObject->material.GetRefraction();
-    if (ior > 0 && sceneObject->material.GetReflection() > 0) {
-      Vector3d normal = sceneObject->GetNormalAt(position);
-      Vector3d refractionDir = GetRefraction(dir, normal, ior).Normalize();
-      Ray refractionRay(position, refractionDir);
-
-      std::vector<double> refractionIntersections;
-      refractionIntersections.reserve(10024);
-      for (const auto &object : sceneObjects)
-        refractionIntersections.emplace_back(
-            object->GetIntersection(refractionRay));
-
-      if (refractionIntersections.size() > 0) {
-        int closestObjectWithRefraction =
-            ClosestObjectIndex(refractionIntersections);
-        if (closestObjectWithRefraction != -1) {
-          Color refractionColor = 0;
-          double kr = fresnel(dir, normal, ior);
-          bool outside = dir.Dot(normal) < 0;
-          Vec3d bias = normal * BIAS;
-
-          Color reflectionColor =
-              GetReflections(position, dir, sceneObjects, indexOfClosestObject,
-                             lightSources, depth);
-          // compute refraction if it is not a
-          // case of total internal reflection
-          if (kr < 1) {
-            Vector3d refractionIntersection =
-                refractionRay.GetOrigin() +
-                (refractionRay.GetDirection() *
-                 (refractionIntersections[closestObjectWithRefraction]));
-            Vector3d refractionRayOrig = outside
-                                             ? refractionIntersection - bias
-                                             : refractionIntersection + bias;
-
-            refractionColor = Trace(
-                refractionRayOrig, refractionRay.GetDirection(), sceneObjects,
-                closestObjectWithRefraction, lightSources, depth + 1);
-          } else  // TIR
-            refractionColor += reflectionColor;
-          // return 0;
-
-          // mix the two
-          Color refraReflColor =
-              reflectionColor * kr + refractionColor * (1 - kr);
-          return refraReflColor;
-        } else
-          return Color(0);
+Color GetRefractions(const Vector3r &position, const Vector3r &dir,
+                     const Scene &scene, const Hit &hit, unsigned depth) {
+  if (hit.object != -1) {
+    const Material &material = scene.GetMaterial(hit.object);
+
+    double ior = material.GetRefraction();
+    if (ior > 0 && material.GetReflection() > 0) {
+      const Vector3r &normal = hit.normal;
+      Vector3r refractionDir = GetRefraction(dir, normal, ior).Normalize();
+      Ray refractionRay(
+          OffsetRayOrigin(position, hit.geometricNormal, refractionDir),
+          refractionDir);
+
+      Hit refractionHit;
+      rayStats.refractionRays++;
+      if (scene.Intersect(refractionRay, refractionHit, &rayStats.traversal)) {
+        Color refractionColor = 0;
+        double kr = fresnel(dir, normal, ior);
+
+        Color reflectionColor =
+            GetReflections(position, dir, scene, hit, depth);
+        // compute refraction if it is not a
+        // case of total internal reflection
+        if (kr < 1) {
+          // Rays leaving the hit are offset from it by the next bounce
+          Vector3r refractionPosition =
+              refractionRay.GetOrigin() +
+              (refractionRay.GetDirection() * refractionHit.t);
+
+          refractionColor = Trace(refractionPosition,
+                                  refractionRay.GetDirection(), scene,
+                                  refractionHit, depth + 1);
+        } else  // TIR
+          refractionColor += reflectionColor;
+        // return 0;
+
+        // mix the two
+        Color refraReflColor =
+            reflectionColor * kr + refractionColor * (1 - kr);
+        return refraReflColor;
       } else
         return Color(0);
     } else
@@ -258,18 +228,47 @@ Color GetRefractions(const Vector3d &position, const Vector3d &dir,
     return Color(0);
 }
 
+// Neighbouring pixels are usually shadowed by the same object, so the one
+// that blocked the last shadow ray toward this light is tried before the
+// scene is traversed
+bool IsShadowed(const Scene &scene, const Ray &shadowRay, const double distance,
+                const unsigned light) {
+  if (!SHADOW_CACHE_ON)
+    return scene.Occluded(shadowRay, distance, &rayStats.traversal);
+
+  int &occluder = shadowCache.occluders[light];
+  if (occluder != -1) {
+    rayStats.shadowCacheTests++;
+    if (scene.OccludedBy(shadowRay, distance, occluder)) {
+      rayStats.shadowCacheHits++;
+      return true;
+    }
+  }
+  return scene.Occluded(shadowRay, distance, occluder, &rayStats.traversal);
+}
+
 // Get the color of the pixel at the ray-object intersection position
-Color Trace(const Vector3d &intersection, const Vector3d &direction,
-            const std::vector<std::shared_ptr<Object>> &sceneObjects,
-            const int indexOfClosestObject,
-            const std::vector<std::shared_ptr<Light>> &lightSources,
-            const int &depth = 0) {
-  if (indexOfClosestObject != -1 &&
+Color Trace(const Vector3r &intersection, const Vector3r &direction,
+            const Scene &scene, const Hit &hit, const unsigned &depth = 0) {
+  if (hit.object != -1 &&
       depth <= DEPTH)  // not checking depth for infinite mirror effect
                        // (not a lot of overhead)
   {
-    std::shared_ptr<Object> sceneObject = sceneObjects[indexOfClosestObject];
-    Vector3d normal = sceneObject->GetNormalAt(intersection);
+    // Everything about the hit comes from the hit record and the shared
+    // scene is only read, so any number of threads can trace it
+    const Material &material = scene.GetMaterial(hit.object);
+    const Vector3r &normal = hit.normal;
+
+    Color color = material.GetColor();
+    if (material.GetSpecial() == 2)  // Checkerboard pattern floor
+    {
+      unsigned square = int(floor(intersection.x)) +
+                        int(floor(intersection.z));  // (floor() rounds down)
+      if (square % 2 == 0)                           // black tile
+        color = Color(0);
+      else  // white tile
+        color = Color(255);
+    }
 
     Color ambient;
     Color diffuse;
@@ -280,15 +279,21 @@ Color Trace(const Vector3d &intersection, const Vector3d &direction,
 
     // Ambient
     if (AMBIENT_ON) {
-      ambient = sceneObject->material.GetColor() * AMBIENT_LIGHT *
-                sceneObject->material.GetAmbient();
+      ambient = color * AMBIENT_LIGHT *
+                material.GetAmbient();
       finalColor += ambient;
     }
 
     // Shadows, Diffuse, Specular
     if (SHADOWS_ON || DIFFUSE_ON || SPECULAR_ON) {
-      Vector3d lightDir;
-      for (const auto &lightSource : lightSources) {
+      Vector3r lightDir;
+      LightSample lightSamples[LIGHT_SAMPLES];
+      unsigned sampleCount =
+          scene.SampleLights(intersection, lightRng, lightSamples);
+      for (unsigned sample = 0; sample < sampleCount; sample++) {
+        const unsigned light = lightSamples[sample].light;
+        const double weight = lightSamples[sample].weight;
+        const auto &lightSource = scene.lightSources[light];
         bool shadowed = false;
         if (lightSource->POINT)
           lightDir =
@@ -300,51 +305,33 @@ Color Trace(const Vector3d &intersection, const Vector3d &direction,
 
         // Shadows
         if (SHADOWS_ON && lambertian > 0) {
-          Ray shadowRay(intersection,
-                        lightDir);  // Cast a ray from the
-          // first intersection to
-          // the light
-          std::vector<double> secondaryIntersections;
-          secondaryIntersections.reserve(1024);
-
-          for (const auto &object : sceneObjects) {
-            secondaryIntersections.emplace_back(
-                object->GetIntersection(shadowRay));
-            std::atomic_fetch_add(&numSecondaryRays, 1);
-          }
-
-          for (const auto &secondaryIntersection : secondaryIntersections) {
-            if (secondaryIntersection > BIAS)  // If shadow ray
-                                               // intersects with
-                                               // some object along
-                                               // the way
-            {
-              if (secondaryIntersection <= distance) {
-                shadowed = true;
-                break;
-              }
-            }
-          }
+          // Cast a ray from the first intersection to the light
+          Ray shadowRay(
+              OffsetRayOrigin(intersection, hit.geometricNormal, lightDir),
+              lightDir);
+          // Any blocker before the light will do, not just the closest
+          shadowed = IsShadowed(scene, shadowRay, distance, light);
+          rayStats.shadowRays++;
         }
 
         // Diffuse
         if (DIFFUSE_ON && shadowed == false) {
-          diffuse = sceneObject->material.GetColor().Average(
+          diffuse = color.Average(
                         lightSource->GetColor()) *
-                    sceneObject->material.GetDiffuse() *
+                    material.GetDiffuse() *
                     lightSource->GetIntensity() * std::fmax(lambertian, 0) /
                     distance;
-          finalColor += diffuse;
+          finalColor += diffuse * weight;
         }
 
         // Specular
         if (shadowed == false && SPECULAR_ON) {
-          if (sceneObject->material.GetSpecular() > 0 &&
-              sceneObject->material.GetSpecular() <= 1 &&
-              sceneObject->material.GetRefraction() != GLOBAL_REFRACTION) {
-            Vector3d V = -direction;
+          if (material.GetSpecular() > 0 &&
+              material.GetSpecular() <= 1 &&
+              material.GetRefraction() != GLOBAL_REFRACTION) {
+            Vector3r V = -direction;
             // Blinn-Phong
-            Vector3d H = (lightDir + V).Normalize();
+            Vector3r H = (lightDir + V).Normalize();
             double NdotH = normal.Dot(H);
 
             phong = pow(NdotH, 500);
@@ -354,51 +341,36 @@ Color Trace(const Vector3d &intersection, const Vector3d &direction,
             // add
             // or
             // no?
-            finalColor += specular * sceneObject->material.GetSpecular();
+            finalColor += specular * material.GetSpecular() * weight;
           }
         }
       }
     }
 
     // perfect mirrors
-    if (REFLECTIONS_ON && sceneObject->material.GetRefraction() == 0 &&
-        sceneObject->material.GetReflection() > 0) {
+    if (REFLECTIONS_ON && material.GetRefraction() == 0 &&
+        material.GetReflection() > 0) {
       Color reflections =
-          GetReflections(intersection, direction, sceneObjects,
-                         indexOfClosestObject, lightSources, depth + 1);
+          GetReflections(intersection, direction, scene, hit, depth + 1);
       finalColor += reflections;
     }
 
     // Reflections & Refractions
-    if (REFRACTIONS_ON && sceneObject->material.GetRefraction() > 0 &&
-        sceneObject->material.GetReflection() > 0) {
+    if (REFRACTIONS_ON && material.GetRefraction() > 0 &&
+        material.GetReflection() > 0) {
       Color refractions =
-          GetRefractions(intersection, direction, sceneObjects,
-                         indexOfClosestObject, lightSources, depth + 1);
+          GetRefractions(intersection, direction, scene, hit, depth + 1);
       finalColor += refractions;
     }
-    if (sceneObject->material.GetSpecial() == 1)  // Sphere checkerboard
+    if (material.GetSpecial() == 1)  // Sphere checkerboard
     {
       double scale = 4;
-      double pattern =
-          (fmod(sceneObject->GetTexCoords(normal, intersection).x * scale, 1) >
-           0.5) ^
-          (fmod(sceneObject->GetTexCoords(normal, intersection).y * scale, 1) >
-           0.5);
-      finalColor += sceneObject->material.GetColor() * pattern *
+      double pattern = (fmod(hit.uv.x * scale, 1) > 0.5) ^
+                       (fmod(hit.uv.y * scale, 1) > 0.5);
+      finalColor += color * pattern *
                     std::fmax(0.f, normal.Dot(-direction));
     }
 
-    if (sceneObject->material.GetSpecial() == 2)  // Checkerboard pattern floor
-    {
-      unsigned square = int(floor(intersection.x)) +
-                        int(floor(intersection.z));  // (floor() rounds down)
-      if (square % 2 == 0)                           // black tile
-        sceneObject->material.SetColor(Color(0));
-      else  // white tile
-        sceneObject->material.SetColor(Color(255));
-    }
-
     finalColor.Clip();
     return finalColor;
   }
@@ -407,73 +379,68 @@ Color Trace(const Vector3d &intersection, const Vector3d &direction,
     return Color(0);
 }
 
-void Render(bitmap_image *image, const unsigned x, const unsigned y,
-            const Color tempColor[]) {
+// Writes the red, green and blue bytes of one pixel
+void Render(unsigned char pixel[3], const Color tempColor[]) {
   Color totalColor = Color(0);
 
-  for (int col = 0; col < SUPERSAMPLING * SUPERSAMPLING; col++) {
+  for (unsigned col = 0; col < SUPERSAMPLING * SUPERSAMPLING; col++) {
     totalColor += tempColor[col];
   }
 
   Color avgColor = totalColor / (SUPERSAMPLING * SUPERSAMPLING);
-  image->set_pixel(x, y, char(avgColor.GetRed()), char(avgColor.GetGreen()),
-                   char(avgColor.GetBlue()));
+  pixel[0] = char(avgColor.GetRed());
+  pixel[1] = char(avgColor.GetGreen());
+  pixel[2] = char(avgColor.GetBlue());
 }
 
 // Camera pos, sceneDirection here
-void EvaluateIntersections(
-    const double xCamOffset, const double yCamOffset, const unsigned aaIndex,
-    Color tempColor[], const Matrix44f &cameraToWorld,
-    const std::vector<std::shared_ptr<Object>> &sceneObjects,
-    const std::vector<std::shared_ptr<Light>> &lightSources) {
-  Camera camera(Vector3d(0, 1.8, 6), Vector3d(0, 0, -1));
-
-  Vector3d camRayDir;
-  cameraToWorld.MultDirMatrix(Vector3d(xCamOffset, yCamOffset - 0.1, -1),
+void EvaluateIntersections(const double xCamOffset, const double yCamOffset,
+                           const unsigned aaIndex, Color tempColor[],
+                           const Matrix44f &cameraToWorld, const Scene &scene) {
+  Camera camera(Vector3r(0, 1.8, 6), Vector3r(0, 0, -1));
+
+  Vector3r camRayDir;
+  cameraToWorld.MultDirMatrix(Vector3r(xCamOffset, yCamOffset - 0.1, -1),
                               camRayDir);
   camRayDir.Normalize();
   camera.SetTo(camRayDir);
   // Shoot ray into evey pixel of the image
   Ray camRay(camera.GetFrom(), camera.GetTo());
 
-  std::vector<double> intersections;
-  intersections.reserve(2048);
-
   // Check if ray intersects with any scene sceneObjects
-  for (const auto &sceneObject : sceneObjects) {
-    intersections.emplace_back(sceneObject->GetIntersection(camRay));
-
-    std::atomic_fetch_add(&numPrimaryRays, 1);
-  }
-
-  int indexOfClosestObject = ClosestObjectIndex(intersections);
+  Hit hit;
+  scene.Intersect(camRay, hit, &rayStats.traversal);
+  rayStats.primaryRays++;
 
   // If it doesn't register a ray trace set that pixel to be black (ray
   // missed everything)
-  if (indexOfClosestObject == -1)
+  if (hit.object == -1)
     tempColor[aaIndex] = Color(0);
-  else  // Ray hit an object
+  else  // Ray hit an object, hits are always further than BIAS
   {
-    if (intersections[indexOfClosestObject] >
-        BIAS)  // If intersection at that position > accuracy, get
-               // color of object
-    {
-      std::atomic_fetch_add(&numPrimaryHitRays, 1);
-      // If ray hit something, set position position to
-      // ray-object intersection
-      Vector3d intersection(
-          (camera.GetFrom() +
-           (camera.GetTo() * intersections[indexOfClosestObject])));
-
-      tempColor[aaIndex] =
-          Trace(intersection, camera.GetTo(), sceneObjects,
-                indexOfClosestObject, lightSources);
-    }
+    rayStats.primaryHits++;
+    // If ray hit something, set position position to
+    // ray-object intersection
+    Vector3r intersection((camera.GetFrom() + (camera.GetTo() * hit.t)));
+
+    tempColor[aaIndex] = Trace(intersection, camera.GetTo(), scene, hit);
   }
 }
 
-void launchThread(const unsigned start, const unsigned end,
-                  bitmap_image *image) {
+// Time one thread spent on the render: busy rendering tiles and idle once the
+// tiles ran out, waiting for the others to finish theirs. Also the rays it
+// traced
+struct ThreadStats {
+  unsigned tiles = 0;
+  double busyMs = 0, idleMs = 0;
+  RayStats rays;
+};
+
+constexpr unsigned TILES_X = (WIDTH + TILE_SIZE - 1) / TILE_SIZE;
+constexpr unsigned TILES_Y = (HEIGHT + TILE_SIZE - 1) / TILE_SIZE;
+
+void RenderPixel(const unsigned x, const unsigned y, unsigned char pixel[3],
+                 const Matrix44f &cameraToWorld, const Scene &scene) {
   Color tempColor[SUPERSAMPLING * SUPERSAMPLING];
   unsigned aaIndex;
   double xCamOffset,
@@ -481,72 +448,164 @@ void launchThread(const unsigned start, const unsigned end,
   // where camera is pointed (x & y positions)
 
   double scale = tan(deg2rad(FOV * 0.5));
-
-  Matrix44f cameraToWorld;
-  Vector3d orig;
-  cameraToWorld.MultVecMatrix(Vector3d(0), orig);
-
-  // Set up scene
-  Scene scene;  // For some reason, when these objects are taken out of the
-  // threads, visual bugs occur
-  std::vector<std::shared_ptr<Object>> sceneObjects = scene.InitObjects();
-  std::vector<std::shared_ptr<Light>> lightSources = scene.InitLightSources();
-
   double aspectRatio = WIDTH / double(HEIGHT);
-  for (unsigned z = start; z < end; z++) {
-    unsigned x = z % WIDTH;
-    unsigned y = z / WIDTH;
-
-    for (unsigned i = 0; i < SUPERSAMPLING; i++) {
-      for (unsigned j = 0; j < SUPERSAMPLING; j++) {
-        // Heigh cannot be bigger than width
-        aaIndex = j * SUPERSAMPLING + i;
-        // Supersampling anti-aliasing
-        if (SUPERSAMPLING != 1) {
-          xCamOffset =
-              (2 * (x + (0.5 + i) / (SUPERSAMPLING)) / double(WIDTH) - 1) *
-              aspectRatio * scale;
-          yCamOffset =
-              (1 - 2 * (y + (j + 0.5) / SUPERSAMPLING) / double(HEIGHT)) *
-              scale;
-        } else  // No Anti-aliasing
-        {
-          xCamOffset =
-              (2 * (x + 0.5) / double(WIDTH) - 1) * aspectRatio * scale;
-          yCamOffset = (1 - 2 * (y + 0.5) / double(HEIGHT)) * scale;
-        }
-        EvaluateIntersections(xCamOffset, yCamOffset, aaIndex, tempColor,
-                              cameraToWorld, sceneObjects, lightSources);
+  for (unsigned i = 0; i < SUPERSAMPLING; i++) {
+    for (unsigned j = 0; j < SUPERSAMPLING; j++) {
+      // Heigh cannot be bigger than width
+      aaIndex = j * SUPERSAMPLING + i;
+      // Supersampling anti-aliasing
+      if (SUPERSAMPLING != 1) {
+        xCamOffset =
+            (2 * (x + (0.5 + i) / (SUPERSAMPLING)) / double(WIDTH) - 1) *
+            aspectRatio * scale;
+        yCamOffset =
+            (1 - 2 * (y + (j + 0.5) / SUPERSAMPLING) / double(HEIGHT)) * scale;
+      } else  // No Anti-aliasing
+      {
+        xCamOffset = (2 * (x + 0.5) / double(WIDTH) - 1) * aspectRatio * scale;
+        yCamOffset = (1 - 2 * (y + 0.5) / double(HEIGHT)) * scale;
       }
+      EvaluateIntersections(xCamOffset, yCamOffset, aaIndex, tempColor,
+                            cameraToWorld, scene);
     }
-    Render(image, x, y, tempColor);
   }
-  std::cout << "Thread finished" << std::endl;
+  Render(pixel, tempColor);
+}
+
+// Renders tiles, taking the next one of tileOrder from nextTile, until none
+// are left. pixelOrder is the order of the pixels within a tile
+void RenderTiles(std::atomic<unsigned> *nextTile,
+                 const std::vector<unsigned> &tileOrder,
+                 const std::vector<unsigned> &pixelOrder, bitmap_image *image,
+                 const Scene &scene, ThreadStats *stats) {
+  shadowCache = ShadowCache();
+  rayStats = RayStats();
+  shadowCache.occluders.assign(scene.lightSources.size(), -1);
+
+  Matrix44f cameraToWorld;
+  Vector3r orig;
+  cameraToWorld.MultVecMatrix(Vector3r(0), orig);
+
+  // Tiles are rendered into a buffer of this thread's and copied into the
+  // image when done. Allocated and first written here, so with pinned
+  // workers it is on the worker's NUMA node
+  std::vector<unsigned char> tilePixels(3 * TILE_SIZE * TILE_SIZE);
+
+  for (unsigned next = (*nextTile)++; next < tileOrder.size();
+       next = (*nextTile)++) {
+    const unsigned tile = tileOrder[next];
+    auto tileStart = std::chrono::high_resolution_clock::now();
+    // Seeded per tile, so the image doesn't depend on which thread got it
+    lightRng.seed(tile + 1);
+
+    unsigned x0 = tile % TILES_X * TILE_SIZE, y0 = tile / TILES_X * TILE_SIZE;
+    unsigned x1 = std::min(x0 + TILE_SIZE, WIDTH);
+    unsigned y1 = std::min(y0 + TILE_SIZE, HEIGHT);
+    for (unsigned pixel : pixelOrder) {
+      unsigned x = x0 + pixel % TILE_SIZE, y = y0 + pixel / TILE_SIZE;
+      if (x < x1 && y < y1)
+        RenderPixel(x, y, &tilePixels[3 * pixel], cameraToWorld, scene);
+    }
+    for (unsigned y = y0; y < y1; y++)
+      for (unsigned x = x0; x < x1; x++) {
+        const unsigned char *pixel =
+            &tilePixels[3 * ((y - y0) * TILE_SIZE + x - x0)];
+        image->set_pixel(x, y, pixel[0], pixel[1], pixel[2]);
+      }
+
+    auto tileEnd = std::chrono::high_resolution_clock::now();
+    stats->tiles++;
+    stats->busyMs +=
+        std::chrono::duration<double, std::milli>(tileEnd - tileStart).count();
+  }
+  stats->rays += rayStats;
+}
+
+std::unique_ptr<Scene> SetUpScene() {
+  std::unique_ptr<Scene> scene(new Scene);
+  scene->InitObjects();
+  scene->InitLightSources();
+  scene->BuildAccelerator();
+  return scene;
 }
 
 void CalcIntersections() {
   bitmap_image *image = new bitmap_image(WIDTH, HEIGHT);
 
-  unsigned nThreads = std::thread::hardware_concurrency();
+  ThreadPool &pool = GlobalPool();
+  unsigned nThreads = pool.WorkerCount();
   std::cout << "Resolution: " << WIDTH << "x" << HEIGHT << std::endl;
   std::cout << "Supersampling: " << SUPERSAMPLING << std::endl;
   std::cout << "Threads: " << nThreads << std::endl;
 
-  std::thread *tt = new std::thread[nThreads];
-
-  unsigned size = WIDTH * HEIGHT;
-
-  unsigned chunk = size / nThreads;
-  unsigned rem = size % nThreads;
-
-  // launch threads
-  for (unsigned i = 0; i < nThreads - 1; i++) {
-    tt[i] = std::thread(launchThread, i * chunk, (i + 1) * chunk, image);
+  const bool replicate = NUMA_REPLICATE_SCENE &&
+                         THREAD_AFFINITY != ThreadAffinity::None &&
+                         pool.NodeCount() > 1;
+  if (THREAD_AFFINITY != ThreadAffinity::None)
+    printf("NUMA: %u nodes, %s affinity, scene %s\n", pool.NodeCount(),
+           THREAD_AFFINITY == ThreadAffinity::Compact ? "compact" : "scatter",
+           replicate ? "replicated per node" : "shared");
+
+  // Set up the scene once, threads only read it while rendering so they all
+  // share this one (meshes are parsed and their accelerators built once).
+  // Replicas are set up by a worker of their node so their memory is
+  // allocated there
+  auto setupStart = std::chrono::high_resolution_clock::now();
+  std::vector<std::unique_ptr<Scene>> nodeScenes(replicate ? pool.NodeCount()
+                                                           : 1);
+  if (replicate) {
+    TaskGroup setup;
+    for (unsigned node = 0; node < pool.NodeCount(); node++) {
+      unsigned worker = 0;
+      while (pool.WorkerNode(worker) != node) worker++;
+      pool.SubmitTo(worker, setup,
+                    [&, node] { nodeScenes[node] = SetUpScene(); });
+    }
+    pool.Wait(setup);
+  } else
+    nodeScenes[0] = SetUpScene();
+  const Scene &scene = *nodeScenes[0];
+  auto setupEnd = std::chrono::high_resolution_clock::now();
+  printf("Scene: %zu objects, %zu KB, set up in %.1f ms\n",
+         scene.sceneObjects.size(),
+         nodeScenes.size() * scene.GetMemoryUsage() / 1024,
+         std::chrono::duration<double, std::milli>(setupEnd - setupStart)
+             .count());
+
+  const std::vector<unsigned> tileOrder =
+      OrderCells(TILES_X, TILES_Y, TILE_ORDER);
+  const std::vector<unsigned> pixelOrder =
+      OrderCells(TILE_SIZE, TILE_SIZE, PIXEL_ORDER);
+  std::atomic<unsigned> nextTile(0);
+  std::vector<ThreadStats> stats(nThreads);
+
+  // One tile loop per worker, this thread runs one of them while waiting
+  auto renderStart = std::chrono::high_resolution_clock::now();
+  TaskGroup render;
+  for (unsigned i = 0; i < nThreads; i++)
+    pool.SubmitTo(i, render, [&, i] {
+      const Scene &nodeScene = *nodeScenes[replicate ? pool.WorkerNode(i) : 0];
+      RenderTiles(&nextTile, tileOrder, pixelOrder, image, nodeScene,
+                  &stats[i]);
+    });
+  pool.Wait(render);
+  auto renderEnd = std::chrono::high_resolution_clock::now();
+  double renderMs =
+      std::chrono::duration<double, std::milli>(renderEnd - renderStart)
+          .count();
+
+  const char *orderNames[] = {"scanline", "Morton", "Hilbert"};
+  printf("Tiles: %u of %ux%u pixels, %s order, pixels in %s order\n",
+         TILES_X * TILES_Y, TILE_SIZE, TILE_SIZE,
+         orderNames[int(TILE_ORDER)], orderNames[int(PIXEL_ORDER)]);
+  for (unsigned i = 0; i < nThreads; i++) {
+    stats[i].idleMs = std::max(renderMs - stats[i].busyMs, 0.0);
+    printf("Thread %2u: %5u tiles, busy %8.1f ms, idle %8.1f ms\n", i,
+           stats[i].tiles, stats[i].busyMs, stats[i].idleMs);
+    totalRayStats += stats[i].rays;
   }
-
-  launchThread((nThreads - 1) * chunk, (nThreads)*chunk + rem, image);
-
-  for (unsigned int i = 0; i < nThreads - 1; i++) tt[i].join();
+  printf("Render: %.1f ms, %.3f Mrays/s\n", renderMs,
+         totalRayStats.Rays() / (renderMs * 1000));
 
   std::string saveString = std::to_string(int(WIDTH)) + "x" +
                            std::to_string(int(HEIGHT)) + ", " +
@@ -556,19 +615,46 @@ void CalcIntersections() {
   std::cout << "Output filename: " << saveString << std::endl;
 }
 
-int main() {
+int main(int argc, char *argv[]) {
+  if (argc > 1 && std::string(argv[1]) == "bench") {
+    int result = RunBenchmarks(argc - 2, argv + 2);
+    ShutdownGlobalPool();
+    return result;
+  }
+
   auto timeStart = std::chrono::high_resolution_clock::now();
   CalcIntersections();
+  ShutdownGlobalPool();
 
   auto timeEnd = std::chrono::high_resolution_clock::now();
   auto passedTime =
       std::chrono::duration<double, std::milli>(timeEnd - timeStart).count();
-  printf("Total number of primary rays                  : %i\n",
-         int(numPrimaryRays));
-  printf("Total number of primary rays that intersected : %i\n",
-         int(numPrimaryHitRays));
-  printf("Total number of secondary rays                : %i\n",
-         int(numSecondaryRays));
+  const RayStats &rays = totalRayStats;
+  printf("Primary rays                : %12llu (%llu hit)\n",
+         (unsigned long long)rays.primaryRays,
+         (unsigned long long)rays.primaryHits);
+  printf("Shadow rays                 : %12llu\n",
+         (unsigned long long)rays.shadowRays);
+  printf("Reflection rays             : %12llu\n",
+         (unsigned long long)rays.reflectionRays);
+  printf("Refraction rays             : %12llu\n",
+         (unsigned long long)rays.refractionRays);
+  printf("Total rays                  : %12llu\n",
+         (unsigned long long)rays.Rays());
+  printf("Node visits                 : %12llu (%.2f per ray)\n",
+         (unsigned long long)rays.traversal.nodeVisits,
+         double(rays.traversal.nodeVisits) /
+             std::max<uint64_t>(rays.Rays(), 1));
+  printf("Object intersection tests   : %12llu (%.2f per ray)\n",
+         (unsigned long long)rays.traversal.primitiveTests,
+         double(rays.traversal.primitiveTests) /
+             std::max<uint64_t>(rays.Rays(), 1));
+  if (SHADOW_CACHE_ON)
+    printf("Shadow occluder cache hits  : %12llu of %llu (%.1f%%)\n",
+           (unsigned long long)rays.shadowCacheHits,
+           (unsigned long long)rays.shadowCacheTests,
+           100.0 * rays.shadowCacheHits /
+               std::max<uint64_t>(rays.shadowCacheTests, 1));
   std::cout << "Time: " << passedTime / 1000 << " seconds" << std::endl;
 
   std::cout << "\nPress enter to exit...";